@@ -0,0 +1,201 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DecryptEngine.h"
+
+using namespace Thunder;
+
+namespace CDMi {
+
+constexpr uint8_t DecryptEngine::MaxThreads;
+constexpr uint32_t DecryptEngine::MinimumChunk;
+constexpr uint8_t DecryptEngine::Queue::Capacity;
+
+DecryptEngine::Runner::Runner(DecryptEngine& parent, const uint8_t index)
+    : Core::Thread(Core::Thread::DefaultStackSize(), _T("widevine-decrypt"))
+    , _parent(parent)
+    , _index(index)
+{
+    Core::Thread::Run();
+}
+
+uint32_t DecryptEngine::Runner::Worker()
+{
+    Item item;
+
+    if (_parent.Take(_index, item) == true) {
+        _parent.Execute(item);
+    } else {
+        std::unique_lock<std::mutex> lock(_parent._lock);
+        _parent._work.wait(lock, [this]() { return ((_parent._queued.load() > 0) || (_parent._running == false)); });
+    }
+
+    return (0);
+}
+
+DecryptEngine::DecryptEngine()
+    : _threads(0)
+    , _next(0)
+    , _queued(0)
+    , _lock()
+    , _work()
+    , _done()
+    , _running(false)
+    , _queues()
+    , _runners()
+{
+}
+
+DecryptEngine::~DecryptEngine()
+{
+    Stop();
+}
+
+void DecryptEngine::Start(const uint8_t threads)
+{
+    ASSERT(_threads == 0);
+
+    _threads = (threads > MaxThreads ? MaxThreads : threads);
+
+    if (_threads > 0) {
+        _running = true;
+        _queues.reset(new Queue[_threads]);
+        _runners.reserve(_threads);
+
+        for (uint8_t index = 0; index < _threads; index++) {
+            _runners.emplace_back(new Runner(*this, index));
+        }
+    }
+}
+
+void DecryptEngine::Stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        if (_running == false) {
+            return;
+        }
+        _running = false;
+    }
+
+    for (std::unique_ptr<Runner>& runner : _runners) {
+        runner->Stop();
+    }
+
+    _work.notify_all();
+
+    for (std::unique_ptr<Runner>& runner : _runners) {
+        runner->Wait(Core::Thread::STOPPED, Core::infinite);
+    }
+
+    _runners.clear();
+}
+
+void DecryptEngine::Submit(Completion& completion, Task&& task)
+{
+    Item item;
+    item.completion = &completion;
+    item.task = std::move(task);
+
+    completion._pending.fetch_add(1);
+
+    if (_threads == 0) {
+        Execute(item);
+        return;
+    }
+
+    // Counted before it is queued, so a worker never sees more items than
+    // the count says.
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _queued.fetch_add(1);
+    }
+
+    Queue& queue(_queues[_next.fetch_add(1, std::memory_order_relaxed) % _threads]);
+    bool queued = false;
+    {
+        std::unique_lock<std::mutex> lock(queue.lock);
+        if (queue.count < Queue::Capacity) {
+            queue.items[(queue.head + queue.count) % Queue::Capacity] = std::move(item);
+            queue.count++;
+            queued = true;
+        }
+    }
+
+    if (queued == true) {
+        _work.notify_one();
+    } else {
+        _queued.fetch_sub(1);
+        Execute(item);
+    }
+}
+
+bool DecryptEngine::Complete(Completion& completion)
+{
+    while (completion._pending.load() > 0) {
+        Item item;
+
+        if ((_threads > 0) && (Take(0, item) == true)) {
+            Execute(item);
+        } else {
+            std::unique_lock<std::mutex> lock(_lock);
+            _done.wait(lock, [&completion]() { return (completion._pending.load() == 0); });
+        }
+    }
+
+    return (completion._failed.load() == false);
+}
+
+// Own queue first (oldest first), then steal the newest item of the others.
+bool DecryptEngine::Take(const uint8_t index, Item& item)
+{
+    for (uint8_t offset = 0; offset < _threads; offset++) {
+        Queue& queue(_queues[(index + offset) % _threads]);
+        std::unique_lock<std::mutex> lock(queue.lock);
+
+        if (queue.count > 0) {
+            if (offset == 0) {
+                item = std::move(queue.items[queue.head]);
+                queue.head = (queue.head + 1) % Queue::Capacity;
+            } else {
+                item = std::move(queue.items[(queue.head + queue.count - 1) % Queue::Capacity]);
+            }
+            queue.count--;
+            _queued.fetch_sub(1);
+            return (true);
+        }
+    }
+    return (false);
+}
+
+void DecryptEngine::Execute(Item& item)
+{
+    Completion& completion(*item.completion);
+
+    if (item.task() == false) {
+        completion._failed.store(true);
+    }
+
+    if (completion._pending.fetch_sub(1) == 1) {
+        std::unique_lock<std::mutex> lock(_lock);
+        _done.notify_all();
+    }
+}
+
+} // namespace CDMi
@@ -0,0 +1,150 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Module.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace CDMi {
+
+// Optional pool of decrypt workers. A large sample is split into ranges
+// that decrypt independently (AES-CTR block ranges, CBC ranges with the
+// IV taken from the preceding ciphertext block), the ranges are spread
+// over the workers and the submitting thread helps out until its ranges
+// completed. Every worker has its own queue, submissions go round robin
+// and an idle worker steals from the back of the others' queues, so
+// samples of concurrent sessions are spread over all cores.
+class DecryptEngine {
+public:
+    // Keep the captures within two pointers, std::function then stores
+    // them inline instead of on the heap.
+    typedef std::function<bool()> Task;
+
+    static constexpr uint8_t MaxThreads = 15;
+    // Ranges smaller than this are not worth the hand-over.
+    static constexpr uint32_t MinimumChunk = 32 * 1024;
+
+    // The tasks of one submitter, e.g. the ranges of one sample.
+    class Completion {
+    public:
+        Completion(const Completion&) = delete;
+        Completion& operator=(const Completion&) = delete;
+
+        Completion()
+            : _pending(0)
+            , _failed(false)
+        {
+        }
+        ~Completion() = default;
+
+    private:
+        friend class DecryptEngine;
+
+        std::atomic<uint32_t> _pending;
+        std::atomic<bool> _failed;
+    };
+
+private:
+    struct Item {
+        Completion* completion;
+        Task task;
+    };
+
+    // Fixed ring, so queueing never allocates. A task that finds its queue
+    // full runs on the submitting thread.
+    struct Queue {
+        static constexpr uint8_t Capacity = 32;
+
+        Queue()
+            : lock()
+            , items()
+            , head(0)
+            , count(0)
+        {
+        }
+
+        std::mutex lock;
+        Item items[Capacity];
+        uint8_t head;
+        uint8_t count;
+    };
+
+    class Runner : public Thunder::Core::Thread {
+    public:
+        Runner() = delete;
+        Runner(const Runner&) = delete;
+        Runner& operator=(const Runner&) = delete;
+
+        Runner(DecryptEngine& parent, const uint8_t index);
+        ~Runner() override = default;
+
+    private:
+        uint32_t Worker() override;
+
+    private:
+        DecryptEngine& _parent;
+        const uint8_t _index;
+    };
+
+public:
+    DecryptEngine(const DecryptEngine&) = delete;
+    DecryptEngine& operator=(const DecryptEngine&) = delete;
+
+    DecryptEngine();
+    ~DecryptEngine();
+
+public:
+    // Starts the workers, without workers every task runs on the thread
+    // that submits it. Start once, before the first submit.
+    void Start(const uint8_t threads);
+    void Stop();
+
+    inline uint8_t Threads() const {
+        return (_threads);
+    }
+
+    void Submit(Completion& completion, Task&& task);
+    // Runs queued tasks until all tasks of the completion are done. Returns
+    // false if any of them failed.
+    bool Complete(Completion& completion);
+
+private:
+    bool Take(const uint8_t index, Item& item);
+    void Execute(Item& item);
+
+private:
+    uint8_t _threads;
+    std::atomic<uint32_t> _next;
+    std::atomic<uint32_t> _queued;
+    std::mutex _lock;
+    std::condition_variable _work;
+    std::condition_variable _done;
+    bool _running;
+    std::unique_ptr<Queue[]> _queues;
+    std::vector<std::unique_ptr<Runner>> _runners;
+};
+
+} // namespace CDMi
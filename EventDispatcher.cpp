@@ -0,0 +1,301 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "EventDispatcher.h"
+
+using namespace Thunder;
+
+namespace CDMi {
+
+EventDispatcher::EventDispatcher(const uint32_t capacity, const uint32_t window)
+    : Core::Thread(Core::Thread::DefaultStackSize(), _T("widevine-events"))
+    , _capacity(capacity > 0 ? capacity : 1)
+    , _window(window)
+    , _lock()
+    , _available()
+    , _queue()
+    , _held()
+    , _free(_capacity)
+    , _keyStatusPending()
+    , _overflow(false)
+    , _running(true)
+{
+    Core::Thread::Run();
+}
+
+EventDispatcher::~EventDispatcher()
+{
+    Close();
+}
+
+void EventDispatcher::Close()
+{
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        if (_running == false) {
+            return;
+        }
+        _running = false;
+    }
+
+    Core::Thread::Stop();
+    _available.notify_all();
+    Core::Thread::Wait(Core::Thread::STOPPED, Core::infinite);
+
+    std::unique_lock<std::mutex> lock(_lock);
+    _queue.clear();
+    _held.clear();
+    _keyStatusPending.clear();
+}
+
+void EventDispatcher::Forget(const MediaKeySession* session)
+{
+    Events dropped;
+
+    std::unique_lock<std::mutex> lock(_lock);
+
+    for (Events* events : { &_queue, &_held }) {
+        for (Events::iterator index = events->begin(); index != events->end();) {
+            Events::iterator next (std::next(index));
+            if (index->session.get() == session) {
+                dropped.splice(dropped.end(), *events, index);
+            }
+            index = next;
+        }
+    }
+    _keyStatusPending.erase(session);
+
+    lock.unlock();
+
+    Recycle(dropped);
+}
+
+void EventDispatcher::Message(const SessionReference& session, const widevine::Cdm::MessageType messageType, const std::string& message)
+{
+    Events event(Take(session, MESSAGE));
+    event.front().messageType = messageType;
+    event.front().payload.assign(message);
+    Post(event);
+}
+
+void EventDispatcher::KeyStatusChange(const SessionReference& session, const bool hasNewUsableKey)
+{
+    Events event(Take(session, KEY_STATUS_CHANGE));
+
+    // A new usable key is what playback is waiting for, never hold it back.
+    if (hasNewUsableKey == false) {
+        event.front().due = std::chrono::steady_clock::now() + _window;
+    }
+    Post(event);
+}
+
+void EventDispatcher::RemoveComplete(const SessionReference& session)
+{
+    Events event(Take(session, REMOVE_COMPLETE));
+    Post(event);
+}
+
+void EventDispatcher::DeferredComplete(const SessionReference& session, const widevine::Cdm::Status status)
+{
+    Events event(Take(session, DEFERRED_COMPLETE));
+    event.front().status = status;
+    Post(event);
+}
+
+void EventDispatcher::IndividualizationRequest(const SessionReference& session, const std::string& request)
+{
+    Events event(Take(session, INDIVIDUALIZATION_REQUEST));
+    event.front().payload.assign(request);
+    Post(event);
+}
+
+void EventDispatcher::Submit(std::function<void()>&& job)
+{
+    Events event(Take(SessionReference(), JOB));
+    event.front().job = std::move(job);
+    Post(event);
+}
+
+// A free event if there is one, filled in outside of the lock.
+EventDispatcher::Events EventDispatcher::Take(const SessionReference& session, const type kind)
+{
+    Events result;
+
+    std::unique_lock<std::mutex> lock(_lock);
+    if (_free.empty() == false) {
+        result.splice(result.end(), _free, _free.begin());
+    }
+    lock.unlock();
+
+    if (result.empty() == true) {
+        result.emplace_back();
+    }
+
+    Event& event(result.front());
+    event.session = session;
+    event.kind = kind;
+    event.messageType = widevine::Cdm::kLicenseRequest;
+    event.status = widevine::Cdm::kSuccess;
+    event.payload.clear();
+    event.posted = Metrics::Timestamp();
+    event.due = std::chrono::steady_clock::time_point();
+    return (result);
+}
+
+// The last reference to a session might be among the events, they are
+// released before taking the lock. Events that carried a payload are taken
+// first again, their buffer is likely large enough for the next one.
+void EventDispatcher::Recycle(Events& events)
+{
+    for (Event& event : events) {
+        event.session.reset();
+        event.job = nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(_lock);
+    while ((events.empty() == false) && (_free.size() < _capacity)) {
+        _free.splice((events.front().payload.empty() == false ? _free.begin() : _free.end()), events, events.begin());
+    }
+}
+
+void EventDispatcher::Post(Events& event)
+{
+    std::unique_lock<std::mutex> lock(_lock);
+
+    if (_running == false) {
+        return;
+    }
+
+    Event& posted(event.front());
+
+    if (posted.kind == KEY_STATUS_CHANGE) {
+        if (_keyStatusPending.insert(posted.session.get()).second == false) {
+            // Already pending, it will report the latest statuses anyway.
+            // Only bring it forward if this one may not be held back.
+            if (posted.due == std::chrono::steady_clock::time_point()) {
+                for (Events::iterator index = _held.begin(); index != _held.end(); index++) {
+                    if (index->session == posted.session) {
+                        index->due = posted.due;
+                        _queue.splice(_queue.end(), _held, index);
+                        _available.notify_one();
+                        break;
+                    }
+                }
+            }
+
+            lock.unlock();
+            Recycle(event);
+            return;
+        }
+    }
+
+    if (posted.due != std::chrono::steady_clock::time_point()) {
+        _held.splice(_held.end(), event);
+    } else {
+        _queue.splice(_queue.end(), event);
+    }
+
+    const bool overflow = (_queue.size() + _held.size()) > _capacity;
+
+    if (overflow != _overflow) {
+        _overflow = overflow;
+        if (overflow == true) {
+            TRACE_L1("More than %u CDM events queued, the application is slow to take them", _capacity);
+        }
+    }
+
+    lock.unlock();
+
+    _available.notify_one();
+}
+
+void EventDispatcher::Deliver(Event& event)
+{
+    if (event.kind == JOB) {
+        event.job();
+        return;
+    }
+
+    MediaKeySession& session(*event.session);
+
+    switch (event.kind) {
+    case MESSAGE:
+        session.onMessage(event.messageType, event.payload);
+        break;
+    case KEY_STATUS_CHANGE:
+        session.onKeyStatusChange();
+        break;
+    case REMOVE_COMPLETE:
+        session.onRemoveComplete();
+        break;
+    case DEFERRED_COMPLETE:
+        session.onDeferredComplete(event.status);
+        break;
+    case INDIVIDUALIZATION_REQUEST:
+        session.onDirectIndividualizationRequest(event.payload);
+        break;
+    default:
+        break;
+    }
+
+    session.metrics().Measure(Metrics::DISPATCH, event.posted);
+}
+
+uint32_t EventDispatcher::Worker()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+
+    // Held back key status changes join the queue once their window
+    // closed, so the burst behind them got absorbed.
+    while (true) {
+        const std::chrono::steady_clock::time_point now (std::chrono::steady_clock::now());
+
+        while ((_held.empty() == false) && (_held.front().due <= now)) {
+            _queue.splice(_queue.end(), _held, _held.begin());
+        }
+
+        if ((_running == false) || (_queue.empty() == false)) {
+            break;
+        }
+
+        if (_held.empty() == true) {
+            _available.wait(lock);
+        } else {
+            _available.wait_until(lock, _held.front().due);
+        }
+    }
+
+    if (_running == true) {
+        Events event;
+        event.splice(event.end(), _queue, _queue.begin());
+
+        if (event.front().kind == KEY_STATUS_CHANGE) {
+            _keyStatusPending.erase(event.front().session.get());
+        }
+
+        lock.unlock();
+
+        Deliver(event.front());
+        Recycle(event);
+    }
+
+    return (0);
+}
+
+} // namespace CDMi
@@ -0,0 +1,148 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Module.h"
+#include "MediaSession.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+namespace CDMi {
+
+// Decouples the CDM event listener from the application callbacks. The CDM
+// posts its events into a queue and returns, one dedicated thread delivers
+// them to the sessions outside of any plugin lock (the session only guards
+// its callback). A slow application callback therefore no longer stalls
+// the CDM thread (and with it the renewals of all other sessions).
+// Posting never blocks: the CDM posts with plugin locks held (e.g. from
+// within Cdm::update) that the dispatch thread may need itself. The queue
+// is unbounded, capacity only sets where a warning is traced.
+// Events are delivered in the order they were posted, so per session order
+// is kept. A key status change that is already pending for a session
+// absorbs later ones: the session reads the current statuses when it is
+// delivered. To batch the bursts a renewal causes, a key status change is
+// held back aside for a short window after it was posted, unless a new
+// usable key arrived. Meanwhile the other events, also those of the same
+// session, are delivered.
+// The events are list nodes that move between the queues by splicing, and
+// return to a free list once delivered. Their payload keeps its capacity,
+// so posting a license message copies it without allocating.
+class EventDispatcher : public Thunder::Core::Thread {
+public:
+    typedef std::shared_ptr<MediaKeySession> SessionReference;
+
+private:
+    enum type : uint8_t {
+        MESSAGE,
+        KEY_STATUS_CHANGE,
+        REMOVE_COMPLETE,
+        DEFERRED_COMPLETE,
+        INDIVIDUALIZATION_REQUEST,
+        JOB
+    };
+
+    struct Event {
+        Event()
+            : session()
+            , kind(JOB)
+            , messageType(widevine::Cdm::kLicenseRequest)
+            , status(widevine::Cdm::kSuccess)
+            , payload()
+            , posted(0)
+            , due()
+            , job()
+        {
+        }
+
+        SessionReference session;
+        type kind;
+        widevine::Cdm::MessageType messageType;
+        widevine::Cdm::Status status;
+        std::string payload;
+        uint64_t posted;
+        std::chrono::steady_clock::time_point due;
+        std::function<void()> job;
+    };
+
+    // A single event while it is filled or delivered, the free ones.
+    typedef std::list<Event> Events;
+
+public:
+    EventDispatcher() = delete;
+    EventDispatcher(const EventDispatcher&) = delete;
+    EventDispatcher& operator=(const EventDispatcher&) = delete;
+
+    // The window (in ms) is how long key status changes are held back.
+    // Beyond capacity queued events a warning is traced, as many are kept
+    // for reuse.
+    EventDispatcher(const uint32_t capacity, const uint32_t window);
+    ~EventDispatcher() override;
+
+public:
+    void Message(const SessionReference& session, const widevine::Cdm::MessageType messageType, const std::string& message);
+    void KeyStatusChange(const SessionReference& session, const bool hasNewUsableKey);
+    void RemoveComplete(const SessionReference& session);
+    void DeferredComplete(const SessionReference& session, const widevine::Cdm::Status status);
+    void IndividualizationRequest(const SessionReference& session, const std::string& request);
+
+    // Runs a plugin job (e.g. refilling the session pool) on the dispatch
+    // thread, in order with the events.
+    void Submit(std::function<void()>&& job);
+
+    // Drops the events still queued for a destroyed session. An event that
+    // is already being delivered, or that was posted after this, finds the
+    // session detached: every session handler checks its callback under the
+    // session's callback lock.
+    void Forget(const MediaKeySession* session);
+
+    // Stops delivery, pending events are dropped. Later events are ignored.
+    // note this includes key status changes that are held back, only call
+    // it once the application no longer listens (plugin shutdown).
+    void Close();
+
+private:
+    Events Take(const SessionReference& session, const type kind);
+    void Recycle(Events& events);
+    void Post(Events& event);
+    void Deliver(Event& event);
+    uint32_t Worker() override;
+
+private:
+    const uint32_t _capacity;
+    const std::chrono::milliseconds _window;
+    std::mutex _lock;
+    std::condition_variable _available;
+    Events _queue;
+    // Key status changes held back, in due order (the window is fixed).
+    Events _held;
+    Events _free;
+    std::unordered_set<const MediaKeySession*> _keyStatusPending;
+    bool _overflow;
+    bool _running;
+};
+
+} // namespace CDMi
@@ -0,0 +1,156 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// Widevine specific extensions of the CDMi interfaces. The OCDM server, or
+// any other host of the plugin, finds them with a dynamic_cast of the
+// IMediaKeys it got from the system factory or of an IMediaKeySession it
+// created:
+//
+//   CDMi::IMediaKeySessionDecrypt* decrypt = dynamic_cast<CDMi::IMediaKeySessionDecrypt*>(session);
+//
+// A null result means the plugin does not offer the extension, the plain
+// CDMi interface still works.
+
+#include <cdmi.h>
+
+#include <string>
+#include <vector>
+
+namespace CDMi {
+
+struct IMediaKeySessionDecrypt {
+    // One CENC subsample: a run of clear bytes followed by a run of
+    // protected bytes.
+    struct SubSample {
+        uint16_t clearBytes;
+        uint32_t encryptedBytes;
+    };
+
+    // One sample of a batch, decrypted in place.
+    struct Sample {
+        const uint8_t* iv;
+        uint32_t ivLength;
+        uint8_t* data;
+        uint32_t length;
+    };
+
+    virtual ~IMediaKeySessionDecrypt() {}
+
+    // Decrypts a complete sample in place, given its subsample map. Clear
+    // runs are left untouched. For cenc and cbc1 the protected runs form
+    // one CTR stream or CBC chain, for cens and cbcs the pattern restarts
+    // on every protected run (cbcs from the constant IV).
+    virtual CDMi_RESULT DecryptSubSamples(
+        const EncryptionScheme encryptionScheme,
+        const EncryptionPattern& pattern,
+        const uint8_t* f_pbIV,
+        uint32_t f_cbIV,
+        uint8_t* f_pbData,
+        uint32_t f_cbData,
+        const SubSample* subSamples,
+        uint32_t subSampleCount,
+        const uint8_t keyIdLength,
+        const uint8_t* keyId) = 0;
+
+    // Decrypts a batch of small, fully encrypted samples (typically audio
+    // frames) that share a key id, paying for the lock and the key lookup
+    // once. Stops at the first sample that fails to decrypt.
+    virtual CDMi_RESULT DecryptSamples(
+        const EncryptionScheme encryptionScheme,
+        const EncryptionPattern& pattern,
+        const Sample* samples,
+        uint32_t sampleCount,
+        const uint8_t keyIdLength,
+        const uint8_t* keyId) = 0;
+
+    // Blocks until the key is usable (CDMi_SUCCESS), the timeout (in ms)
+    // expired or the wait was cancelled (CDMi_S_FALSE), instead of retrying
+    // Decrypt until the license arrived. Without a key id any usable key
+    // will do.
+    virtual CDMi_RESULT WaitForKey(
+        const uint8_t keyIdLength,
+        const uint8_t* keyId,
+        const uint32_t waitTime) = 0;
+
+    // Releases all threads in WaitForKey, e.g. on a seek or when stopping.
+    virtual void CancelWaitForKey() = 0;
+};
+
+struct IMediaKeySessionOutput {
+    virtual ~IMediaKeySessionOutput() {}
+
+    // Registers a shared buffer (e.g. a mapped memfd that the decoder maps
+    // as well) of slotCount (up to 64) slots of slotSize bytes. Decrypt on
+    // this session then returns the clear sample in a free slot of it,
+    // ReleaseClearContent frees the slot. One pool per session at a time,
+    // register it before the first Decrypt.
+    virtual CDMi_RESULT RegisterOutputPool(uint8_t* buffer, const uint32_t slotSize, const uint8_t slotCount) = 0;
+
+    // Fails while any slot is still out, the buffer must stay mapped until
+    // this succeeded.
+    virtual CDMi_RESULT UnregisterOutputPool() = 0;
+};
+
+struct IMediaKeysStatistics {
+    virtual ~IMediaKeysStatistics() {}
+
+    // Reports the decrypt and license metrics as JSON: the totals over all
+    // sessions, including destroyed ones, and each live session by id.
+    // Collection must be enabled with the "metrics" config option.
+    virtual void Statistics(std::string& result) const = 0;
+};
+
+struct IMediaKeysPrefetch {
+    virtual ~IMediaKeysPrefetch() {}
+
+    // Starts the license requests for content that is expected to play soon
+    // (EPG, playlist lookahead), one session per init data. The application
+    // collects each license request with PrefetchChallenge and hands the
+    // server response to PrefetchResponse. A later CreateMediaKeySession for
+    // the same license type and init data gets the prefetched session. The
+    // least recently prefetched sessions are closed once more than the
+    // "prefetch" config option are kept. Returns the number of requests
+    // started or already pending.
+    virtual uint32_t Prefetch(
+        int32_t licenseType,
+        const char* initDataType,
+        const std::vector<std::string>& initData) = 0;
+
+    // The license request of a prefetched session, as it would have been
+    // passed to OnKeyMessage.
+    virtual CDMi_RESULT PrefetchChallenge(
+        int32_t licenseType,
+        const char* initDataType,
+        const uint8_t* initData,
+        uint32_t initDataLength,
+        std::string& challenge) = 0;
+
+    // Loads the license server response into a prefetched session.
+    virtual CDMi_RESULT PrefetchResponse(
+        int32_t licenseType,
+        const char* initDataType,
+        const uint8_t* initData,
+        uint32_t initDataLength,
+        const uint8_t* response,
+        uint32_t responseLength) = 0;
+};
+
+} // namespace CDMi
@@ -19,46 +19,354 @@
 
 #include "HostImplementation.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
 using namespace widevine;
 using namespace Thunder;
 
 namespace CDMi {
 
+static constexpr char TemporarySuffix[] = ".tmp";
+static constexpr uint32_t DirectorySyncDelay = 100; // ms
+static constexpr uint32_t TimerResolution = 10; // ms
+
+// With the FORWARD clock policy, the wall clock is compared with the
+// monotonic estimate at most once per interval, and only a difference
+// beyond the threshold is treated as a jump.
+static constexpr int64_t ClockCheckInterval = 1000; // ms
+static constexpr int64_t ClockJumpThreshold = 2000; // ms
+
+// CLOCK_MONOTONIC_COARSE is served from the vDSO without a syscall, its
+// resolution (one scheduler tick) is plenty for license durations.
+static int64_t MonotonicTime() {
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return ((static_cast<int64_t>(now.tv_sec) * 1000) + (now.tv_nsec / 1000000));
+}
+
+static int64_t WallClockTime() {
+  return static_cast<int64_t>(Core::Time::Now().Ticks() / Core::Time::TicksPerMillisecond); // Ticks -> MilliSeconds
+}
+
+// Files of at least this size in the storage directory are served from a
+// read-only mapping instead of being loaded into memory (licenses, usage
+// tables). A mapping stays valid across a rename over the file, it would
+// raise SIGBUS if the file were truncated underneath it, hence only files
+// the plugin replaces itself are mapped.
+static constexpr size_t MappingThreshold = 4096;
+
+// Only plain file names are persisted, anything that could escape the
+// storage directory is kept in memory.
+static bool IsPersistable(const std::string& name) {
+  return ((name.empty() == false) && (name[0] != '.') && (name.find('/') == std::string::npos));
+}
+
+static bool WriteFile(int fd, const std::string& content) {
+  size_t offset = 0;
+  while (offset < content.size()) {
+    ssize_t written = ::write(fd, content.data() + offset, content.size() - offset);
+    if (written > 0) {
+      offset += written;
+    } else if ((written < 0) && (errno == EINTR)) {
+      continue;
+    } else {
+      break;
+    }
+  }
+  return (offset == content.size());
+}
+
+HostImplementation::File::~File() {
+  Unmap();
+}
+
+HostImplementation::File& HostImplementation::File::operator= (File&& move) {
+  if (this != &move) {
+    Unmap();
+    _content = std::move(move._content);
+    _mapping = move._mapping;
+    _size = move._size;
+    move._mapping = nullptr;
+    move._size = 0;
+  }
+  return (*this);
+}
+
+/* static */ HostImplementation::File HostImplementation::File::Map(int fd, size_t size) {
+  File result;
+
+  if (size > 0) {
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (mapping != MAP_FAILED) {
+      result._mapping = mapping;
+      result._size = size;
+    }
+  }
+  return (result);
+}
+
+void HostImplementation::File::Unmap() {
+  if (_mapping != nullptr) {
+    ::munmap(_mapping, _size);
+    _mapping = nullptr;
+    _size = 0;
+  }
+}
+
+/* static */ bool HostImplementation::Load(const std::string& path, File& file, const bool mappable) {
+  bool result = false;
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd >= 0) {
+    struct stat info;
+
+    if ((::fstat(fd, &info) == 0) && (S_ISREG(info.st_mode))) {
+      const size_t length = static_cast<size_t>(info.st_size);
+
+      if ((mappable == true) && (length >= MappingThreshold)) {
+        file = File::Map(fd, length);
+        result = file.IsMapped();
+      } else {
+        std::string content(length, '\0');
+
+        size_t offset = 0;
+        while (offset < length) {
+          ssize_t loaded = ::read(fd, &content[offset], length - offset);
+          if (loaded > 0) {
+            offset += loaded;
+          } else if ((loaded < 0) && (errno == EINTR)) {
+            continue;
+          } else {
+            break;
+          }
+        }
+        if (offset == length) {
+          file = File(std::move(content));
+          result = true;
+        }
+      }
+    }
+    ::close(fd);
+  }
+  return (result);
+}
+
 HostImplementation::HostImplementation() 
   : widevine::Cdm::IStorage()
   , widevine::Cdm::IClock()
   , widevine::Cdm::ITimer()
-  , _timer(Core::Thread::DefaultStackSize(),  _T("widevine"))
-  , _files() {
+  , _location()
+  , _syncLock()
+  , _syncPending(false)
+  , _directorySync(*this)
+  , _clockPolicy(ClockPolicy::FORWARD)
+  , _clockOffset(WallClockTime() - MonotonicTime())
+  , _clockCheck(0)
+  , _timer(TimerResolution)
+  , _shards() {
 }
 
 HostImplementation::~HostImplementation() {
+  _timer.Revoke(&_directorySync);
+  SyncDirectory();
+}
+
+// Keeps an existing entry, see Open().
+void HostImplementation::Insert(const std::string& name, File&& file) {
+  Shard& shard(ShardOf(name));
+  shard.lock.Lock();
+  shard.files.emplace(name, std::move(file));
+  shard.lock.Unlock();
 }
 
 void HostImplementation::PreloadFile(const std::string& filename, std::string&& filecontent ) {
-  _files.emplace(filename, filecontent);
+  Insert(filename, File(std::move(filecontent)));
+}
+
+bool HostImplementation::LoadFile(const std::string& filename, const std::string& path) {
+  File file;
+  bool result = Load(path, file, false);
+
+  if (result == true) {
+    Insert(filename, std::move(file));
+  }
+  return (result);
+}
+
+bool HostImplementation::Open(const std::string& location) {
+  ASSERT(_location.empty() == true);
+
+  std::string path(location);
+  if ((path.empty() == false) && (path[path.length() - 1] != '/')) {
+    path += '/';
+  }
+
+  // Create the storage directory, including missing parents.
+  for (size_t position = path.find('/', 1); position != std::string::npos; position = path.find('/', position + 1)) {
+    const std::string directory(path, 0, position);
+    if ((::mkdir(directory.c_str(), S_IRWXU) != 0) && (errno != EEXIST)) {
+      TRACE(Trace::Error, (_T("Failed to create storage directory %s: %d"), directory.c_str(), errno));
+      return false;
+    }
+  }
+
+  DIR* dir = ::opendir(path.c_str());
+  if (dir == nullptr) {
+    TRACE(Trace::Error, (_T("Failed to open storage directory %s: %d"), path.c_str(), errno));
+    return false;
+  }
+
+  const size_t suffixLength = sizeof(TemporarySuffix) - 1;
+  uint32_t count = 0;
+  struct dirent* entry;
+
+  while ((entry = ::readdir(dir)) != nullptr) {
+    const std::string name(entry->d_name);
+
+    if (IsPersistable(name) == false) {
+      continue;
+    }
+
+    if ((name.length() > suffixLength) && (name.compare(name.length() - suffixLength, suffixLength, TemporarySuffix) == 0)) {
+      // Left behind by an interrupted write, the previous version is still intact.
+      ::unlink((path + name).c_str());
+      continue;
+    }
+
+    File file;
+    if (Load(path + name, file, true) == true) {
+      Insert(name, std::move(file));
+      count++;
+    }
+  }
+
+  ::closedir(dir);
+
+  TRACE(Trace::Information, (_T("storage %s holds %u files"), path.c_str(), count));
+
+  _location = path;
+  return true;
+}
+
+void HostImplementation::Clock(const ClockPolicy policy) {
+  _clockPolicy = policy;
+}
+
+bool HostImplementation::Persist(Shard& shard, const std::string& name, const std::string& data, const uint64_t version) {
+  const std::string path(_location + name);
+  // Concurrent writes to the same name each use their own temporary file.
+  const std::string temporary(path + '.' + std::to_string(version) + TemporarySuffix);
+  bool result = false;
+
+  int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+  if (fd < 0) {
+    TRACE(Trace::Error, (_T("Failed to create %s: %d"), temporary.c_str(), errno));
+  } else {
+    // Write the new version next to the old one and atomically swap it in,
+    // a crash leaves either the old or the new version, never a mix.
+    result = ((WriteFile(fd, data) == true) && (::fsync(fd) == 0));
+    ::close(fd);
+
+    shard.persistLock.Lock();
+
+    std::unordered_map<std::string, uint64_t>::iterator index = shard.versions.find(name);
+
+    if ((index == shard.versions.end()) || (index->second != version)) {
+      // Superseded by a later write or remove of the same name.
+      ::unlink(temporary.c_str());
+    } else if ((result == true) && (::rename(temporary.c_str(), path.c_str()) == 0)) {
+      shard.versions.erase(index);
+      ScheduleDirectorySync();
+    } else {
+      TRACE(Trace::Error, (_T("Failed to persist %s: %d"), path.c_str(), errno));
+      ::unlink(temporary.c_str());
+      result = false;
+    }
+
+    shard.persistLock.Unlock();
+  }
+  return (result);
+}
+
+void HostImplementation::Unlink(const std::string& name) {
+  if ((::unlink((_location + name).c_str()) == 0) || (errno != ENOENT)) {
+    ScheduleDirectorySync();
+  }
+}
+
+void HostImplementation::ScheduleDirectorySync() {
+  _syncLock.Lock();
+  if (_syncPending == false) {
+    _syncPending = true;
+    _timer.Schedule(DirectorySyncDelay, &_directorySync, nullptr);
+  }
+  _syncLock.Unlock();
+}
+
+void HostImplementation::SyncDirectory() {
+  _syncLock.Lock();
+  if (_syncPending == true) {
+    _syncPending = false;
+
+    int fd = ::open(_location.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+      ::fsync(fd);
+      ::close(fd);
+    }
+  }
+  _syncLock.Unlock();
 }
 
 // widevine::Cdm::IStorage implementation
 // ---------------------------------------------------------------------------
 /* virtual */ bool HostImplementation::read(const std::string& name, std::string* data) {
-  StorageMap::iterator it = _files.find(name);
-  bool ok = it != _files.end();
+  Shard& shard(ShardOf(name));
+  shard.lock.LockShared();
+  StorageMap::const_iterator it = shard.files.find(name);
+  bool ok = it != shard.files.end();
+  if (ok) {
+    data->assign(it->second.Data(), it->second.Size());
+  }
+  shard.lock.Unlock();
   TRACE(Trace::Information, (_T("read file: %s: %s"), name.c_str(), ok ? "ok" : "fail"));
-  if (!ok) return false;
-  *data = it->second;
-  return true;
+  return ok;
 }
 
 /* virtual */ bool HostImplementation::write(const std::string& name, const std::string& data) {
   TRACE(Trace::Information, (_T("write file: %s"), name.c_str()));
-  _files[name] = data;
-  return true;
+  bool ok = true;
+  uint64_t version = 0;
+  Shard& shard(ShardOf(name));
+  shard.lock.Lock();
+  shard.files[name] = File(data);
+  if ((_location.empty() == false) && (IsPersistable(name) == true)) {
+    shard.persistLock.Lock();
+    version = ++shard.sequence;
+    shard.versions[name] = version;
+    shard.persistLock.Unlock();
+  }
+  shard.lock.Unlock();
+
+  // Readers and writers of the shard do not wait for the disk.
+  if (version != 0) {
+    ok = Persist(shard, name, data, version);
+  }
+  return ok;
 }
 
 /* virtual */ bool HostImplementation::exists(const std::string& name) {
-  StorageMap::iterator it = _files.find(name);
-  bool ok = it != _files.end();
+  Shard& shard(ShardOf(name));
+  shard.lock.LockShared();
+  bool ok = (shard.files.find(name) != shard.files.end());
+  shard.lock.Unlock();
   TRACE(Trace::Information, (_T("exists? %s: %s"), name.c_str(), ok ? "true" : "false"));
   return ok;
 }
@@ -67,31 +375,91 @@ void HostImplementation::PreloadFile(const std::string& filename, std::string&&
   TRACE(Trace::Information, (_T("remove: %s"), name.c_str()));
   if (name.empty()) {
     // If no name, delete all files (see DeviceFiles::DeleteAllFiles())
-    _files.clear();
+    for (Shard& shard : _shards) {
+      shard.lock.Lock();
+      if (_location.empty() == false) {
+        shard.persistLock.Lock();
+        for (StorageMap::const_iterator it = shard.files.begin(); it != shard.files.end(); it++) {
+          if (IsPersistable(it->first) == true) {
+            Unlink(it->first);
+          }
+        }
+        shard.versions.clear();
+        shard.persistLock.Unlock();
+      }
+      shard.files.clear();
+      shard.lock.Unlock();
+    }
   } else {
-    _files.erase(name);
+    Shard& shard(ShardOf(name));
+    shard.lock.Lock();
+    shard.files.erase(name);
+    if ((_location.empty() == false) && (IsPersistable(name) == true)) {
+      // A write still in flight must not bring the file back.
+      shard.persistLock.Lock();
+      shard.versions.erase(name);
+      Unlink(name);
+      shard.persistLock.Unlock();
+    }
+    shard.lock.Unlock();
   }
   return true;
 }
 
 /* virtual */ int32_t HostImplementation::size(const std::string& name) {
-  StorageMap::iterator it = _files.find(name);
-  if (it == _files.end()) return -1;
-  return it->second.size();
+  int32_t result = -1;
+  Shard& shard(ShardOf(name));
+  shard.lock.LockShared();
+  StorageMap::const_iterator it = shard.files.find(name);
+  if (it != shard.files.end()) {
+    result = static_cast<int32_t>(it->second.Size());
+  }
+  shard.lock.Unlock();
+  return result;
 }
 
 /* virtual */ bool HostImplementation::list(std::vector<std::string>* names) {
   names->clear();
-  for (StorageMap::iterator it = _files.begin(); it != _files.end(); it++) {
+  for (Shard& shard : _shards) {
+    shard.lock.LockShared();
+    for (StorageMap::const_iterator it = shard.files.begin(); it != shard.files.end(); it++) {
       names->push_back(it->first);
+    }
+    shard.lock.Unlock();
   }
   return true;
 }
 
+/* virtual */ int64_t HostImplementation::WallClock() const {
+  return (WallClockTime());
+}
+
 // widevine::Cdm::IClock implementation
 // ---------------------------------------------------------------------------
 /* virtual */ int64_t HostImplementation::now() {
-  return static_cast<int64_t>(Core::Time::Now().Ticks() / Core::Time::TicksPerMillisecond); // Ticks -> MilliSeconds
+  if (_clockPolicy == ClockPolicy::WALLCLOCK) {
+    return (WallClock());
+  }
+
+  const int64_t monotonic = MonotonicTime();
+  int64_t result = _clockOffset.load(std::memory_order_relaxed) + monotonic;
+
+  if (_clockPolicy == ClockPolicy::FORWARD) {
+    int64_t check = _clockCheck.load(std::memory_order_relaxed);
+
+    // Only one caller per interval pays for looking at the wall clock.
+    if ((monotonic >= check) && (_clockCheck.compare_exchange_strong(check, monotonic + ClockCheckInterval) == true)) {
+      const int64_t wallclock = WallClock();
+
+      if (wallclock > (result + ClockJumpThreshold)) {
+        TRACE(Trace::Information, (_T("wall clock jumped forward by %lld ms"), static_cast<long long>(wallclock - result)));
+        _clockOffset.store(wallclock - monotonic, std::memory_order_relaxed);
+        result = wallclock;
+      }
+    }
+  }
+
+  return (result);
 }
 
 // widevine::Cdm::ITimer implementation
@@ -100,13 +468,11 @@ void HostImplementation::PreloadFile(const std::string& filename, std::string&&
 
   ASSERT ((delay_ms > 0) && (delay_ms < 0xFFFFFFFF));
 
-  Core::Time timeOut = Core::Time::Now().Add(delay_ms);
-
-  _timer.Schedule(timeOut.Ticks(), Timer(client, context));
+  _timer.Schedule(static_cast<uint64_t>(delay_ms), client, context);
 }
 
 /* virtual */ void HostImplementation::cancel(IClient* client) {
-  _timer.Revoke(Timer(client, nullptr));
+  _timer.Revoke(client);
 }
 
 } // namespace CDMi
@@ -20,8 +20,13 @@
 #pragma once
 
 #include "Module.h"
+#include "TimerWheel.h"
 #include "cdm.h"
 
+#include <atomic>
+#include <pthread.h>
+#include <unordered_map>
+
 namespace CDMi {
 
 class HostImplementation : 
@@ -31,41 +36,130 @@ class HostImplementation :
 
 private:
 
-  typedef std::map<std::string, std::string> StorageMap;
+  // A stored file: either owned content or a read-only mapping of the file
+  // on disk. Copies are only made at the IStorage API boundary.
+  class File {
+  public:
+    File(const File&) = delete;
+    File& operator= (const File&) = delete;
+
+    File() : _content(), _mapping(nullptr), _size(0) {
+    }
+    explicit File(std::string&& content) : _content(std::move(content)), _mapping(nullptr), _size(0) {
+    }
+    explicit File(const std::string& content) : _content(content), _mapping(nullptr), _size(0) {
+    }
+    File(File&& move) : _content(std::move(move._content)), _mapping(move._mapping), _size(move._size) {
+      move._mapping = nullptr;
+      move._size = 0;
+    }
+    ~File();
+
+    File& operator= (File&& move);
 
-  class Timer {
   public:
-    Timer() : _client(nullptr), _context(nullptr) {
+    // Maps the file read-only, returns an invalid (empty) File on failure.
+    static File Map(int fd, size_t size);
+
+    inline const char* Data() const {
+      return (_mapping != nullptr ? static_cast<const char*>(_mapping) : _content.data());
+    }
+    inline size_t Size() const {
+      return (_mapping != nullptr ? _size : _content.size());
+    }
+    inline bool IsMapped() const {
+      return (_mapping != nullptr);
+    }
+
+  private:
+    void Unmap();
+
+  private:
+    std::string _content;
+    void* _mapping;
+    size_t _size;
+  };
+
+  typedef std::unordered_map<std::string, File> StorageMap;
+
+  class ReadWriteLock {
+  public:
+    ReadWriteLock(const ReadWriteLock&) = delete;
+    ReadWriteLock& operator= (const ReadWriteLock&) = delete;
+
+    ReadWriteLock() {
+      ::pthread_rwlock_init(&_lock, nullptr);
     }
-    Timer(IClient* client, void* context) : _client(client), _context(context) {
-      ASSERT(client != nullptr);
+    ~ReadWriteLock() {
+      ::pthread_rwlock_destroy(&_lock);
     }
-    Timer(const Timer& copy) : _client(copy._client), _context(copy._context) {
+
+  public:
+    inline void Lock() {
+      ::pthread_rwlock_wrlock(&_lock);
+    }
+    inline void LockShared() {
+      ::pthread_rwlock_rdlock(&_lock);
     }
-    ~Timer () {
+    inline void Unlock() {
+      ::pthread_rwlock_unlock(&_lock);
     }
 
-    Timer& operator= (const Timer& RHS) {
-      _client = RHS._client;
-      _context = RHS._context;
-      return (*this);
+  private:
+    pthread_rwlock_t _lock;
+  };
+
+  // The CDM probes storage from the timer thread as well as from the session
+  // threads. Files are spread over shards by name, each with its own reader/
+  // writer lock, so concurrent exists/size/read calls never serialize and a
+  // writer only blocks the names that share its shard.
+  // The disk is updated outside that lock. Every cache update of a name gets
+  // the next sequence number of its shard, a write only renames its file in
+  // place if it is still the latest version of that name.
+  struct Shard {
+    Shard() : lock(), files(), persistLock(), sequence(0), versions() {
     }
 
+    ReadWriteLock lock;
+    StorageMap files;
+    Thunder::Core::CriticalSection persistLock;
+    uint64_t sequence;
+    std::unordered_map<std::string, uint64_t> versions;
+  };
+
+  static constexpr uint8_t ShardCount = 8;
+
+  // Directory entries created by a rename are only durable once the
+  // directory itself is synced. Writes come in bursts (license, usage
+  // table, ...), so the directory sync is deferred and done once per burst.
+  class DirectorySync : public IClient {
   public:
-    inline bool operator== (const Timer& RHS) const {
-      return (_client == RHS._client);
+    DirectorySync() = delete;
+    DirectorySync(const DirectorySync&) = delete;
+    DirectorySync& operator= (const DirectorySync&) = delete;
+
+    DirectorySync(HostImplementation& parent) : _parent(parent) {
     }
-    inline bool operator!= (const Timer& RHS) const {
-      return (_client != RHS._client);
+    ~DirectorySync() override {
     }
-    inline uint64_t Timed (const uint64_t /* scheduledTime */) {
-      _client->onTimerExpired(_context);
-      return(0); // No need to reschedule.
+
+  public:
+    void onTimerExpired(void* /* context */) override {
+      _parent.SyncDirectory();
     }
 
   private:
-    IClient* _client;
-    void* _context;
+    HostImplementation& _parent;
+  };
+
+public:
+  // How wall-clock changes (NTP, manual) reach the CDM through now().
+  // The plugin is typically loaded before the first NTP sync, a clock that
+  // is anchored only once would stay behind, hence FORWARD is the default.
+  enum class ClockPolicy : uint8_t {
+    MONOTONIC, // anchored to the wall clock once, never jumps
+    FORWARD,   // also follows forward jumps (e.g. a late first NTP sync), never goes back (default)
+    WALLCLOCK  // follows the wall clock, including jumps back
   };
 
 public:
@@ -78,9 +172,25 @@ public:
 
 public:
 
-  // note this method is not thread safe regarding simultanious widevine::Cdm::IStorage callbacks, make sure they cannot be not active when calling this
   void PreloadFile(const std::string& filename, std::string&& filecontent );
 
+  // Same as PreloadFile, but takes the content from the file at the given
+  // path. The file is not owned by the plugin and may be rewritten in place,
+  // so it is always copied, never mapped.
+  bool LoadFile(const std::string& filename, const std::string& path);
+
+  // Backs the storage with the given directory: all files found there are
+  // loaded into the cache, every write or remove is persisted. Files that
+  // were preloaded before take precedence over the ones on disk.
+  // note the directory must be owned by the plugin: large files are served
+  // from a mapping, which is only safe as long as files there are replaced
+  // by a rename (as Persist does) and never truncated or rewritten in place.
+  // note the location can only be set once, before the CDM is initialized
+  bool Open(const std::string& location);
+
+  // note set the policy before the CDM is initialized
+  void Clock(const ClockPolicy policy);
+
   //
   // widevine::Cdm::IStorage implementation
   // ---------------------------------------------------------------------------
@@ -100,9 +210,31 @@ public:
   virtual void setTimeout(int64_t delay_ms, IClient* client, void* context) override;
   virtual void cancel(IClient* client) override;
 
+protected:
+  // Milliseconds since the epoch, the source the clock policy follows.
+  virtual int64_t WallClock() const;
+
+private:
+  inline Shard& ShardOf(const std::string& name) {
+    return (_shards[std::hash<std::string>()(name) % ShardCount]);
+  }
+  void Insert(const std::string& name, File&& file);
+  static bool Load(const std::string& path, File& file, const bool mappable);
+  bool Persist(Shard& shard, const std::string& name, const std::string& data, const uint64_t version);
+  void Unlink(const std::string& name);
+  void ScheduleDirectorySync();
+  void SyncDirectory();
+
 private:
-  Thunder::Core::TimerType<Timer> _timer;
-  StorageMap _files;
+  std::string _location;
+  Thunder::Core::CriticalSection _syncLock;
+  bool _syncPending;
+  DirectorySync _directorySync;
+  ClockPolicy _clockPolicy;
+  std::atomic<int64_t> _clockOffset;
+  std::atomic<int64_t> _clockCheck;
+  TimerWheel _timer;
+  Shard _shards[ShardCount];
 };
 
 } // namespace CDMi
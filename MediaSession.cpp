@@ -19,6 +19,7 @@
 #include "MediaSession.h"
 #include "Policy.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
 #include <openssl/aes.h>
@@ -36,72 +37,434 @@ using namespace std;
 
 namespace CDMi {
 
-Thunder::Core::CriticalSection g_lock;
+// Decrypt and key handling are serialized per session (m_lock). On top of
+// that every CDM call that changes a session or its license (createSession,
+// generateRequest, update, load, remove and close) holds g_cdmLock, they
+// touch the CDM's session table and the storage. decrypt and getKeyStatuses
+// only read and never take it. Where both are needed, m_lock comes first.
+// The application callbacks are made under m_callbackLock only, so a slow
+// callback never holds up a decrypt. It comes before m_lock.
+static Thunder::Core::CriticalSection g_cdmLock;
 
 MediaKeySession::MediaKeySession(widevine::Cdm *cdm, int32_t licenseType)
+    : MediaKeySession(cdm, sessionType(licenseType), std::string()) {
+}
+
+MediaKeySession::MediaKeySession(widevine::Cdm *cdm, widevine::Cdm::SessionType licenseType, const std::string& sessionId)
     : m_cdm(cdm)
     , m_CDMData("")
     , m_initData("")
     , m_initDataType(widevine::Cdm::kCenc)
-    , m_licenseType((widevine::Cdm::SessionType)licenseType)
-    , m_sessionId("") { 
+    , m_licenseType(licenseType)
+    , m_sessionId(sessionId)
+    , m_piCallback(nullptr)
+    , m_detaching(0)
+    , m_callbackLock()
+    , m_requested(false)
+    , m_pendingMessage()
+    , m_pendingUrl()
+    , m_message()
+    , m_response()
+    , m_donor()
+    , m_sharedKeyIds()
+    , m_shared(false)
+    , m_sharedKey()
+    , m_streamsStarted(0)
+    , m_lock()
+    , m_keyStatuses()
+    , m_reportedKeyStatuses()
+    , m_keyStatusReport()
+    , m_keyStatusesValid(false)
+    , m_arena()
+    , m_engine(nullptr)
+    , m_outputPool()
+    , m_metrics()
+    , m_keyWaitLock()
+    , m_keyWait()
+    , m_keyGeneration(0)
+    , m_keyWaitCancel(0)
+    , m_keyWaiters(0)
+    , m_keyWaitClosed(false)
+    , m_retired(false) {
   ASSERT(m_cdm->isProvisioned());
 
-  widevine::Cdm::Status status = m_cdm->createSession(m_licenseType, &m_sessionId);
+  if (m_sessionId.empty() == true) {
+    createSession(m_cdm, m_licenseType, m_sessionId);
+  }
+
+  ::memset(m_streams, 0, sizeof(m_streams));
+}
+
+/* static */ widevine::Cdm::SessionType MediaKeySession::sessionType(int32_t licenseType) {
+  switch ((LicenseType)licenseType) {
+  case PersistentUsageRecord:
+    return widevine::Cdm::kPersistentUsageRecord;
+  case PersistentLicense:
+    return widevine::Cdm::kPersistentLicense;
+  default:
+    return widevine::Cdm::kTemporary;
+  }
+}
+
+/* static */ bool MediaKeySession::createSession(widevine::Cdm *cdm, widevine::Cdm::SessionType licenseType, std::string& sessionId) {
+  g_cdmLock.Lock();
+  widevine::Cdm::Status status = cdm->createSession(licenseType, &sessionId);
+  g_cdmLock.Unlock();
 
   if(status != widevine::Cdm::kSuccess){
     printf("Failed to create a new session: error 0x%04x (%d)\n", status, status);
   }
+  return (status == widevine::Cdm::kSuccess);
+}
 
-  ::memset(m_IV, 0 , sizeof(m_IV));
+/* static */ void MediaKeySession::closeSession(widevine::Cdm *cdm, const std::string& sessionId) {
+  g_cdmLock.Lock();
+  cdm->close(sessionId);
+  g_cdmLock.Unlock();
 }
 
 MediaKeySession::~MediaKeySession(void) {
 }
 
+MediaKeySession::Arena::Arena()
+    : _block()
+    , _size(0)
+    , _used(0)
+    , _spilled(0)
+    , _spills() {
+}
+
+void MediaKeySession::Arena::Reset() {
+  if (_spills.empty() == false) {
+    // The last call did not fit, make room for all of it.
+    _size = _used + _spilled;
+    _block.reset(new uint8_t[_size]);
+    _spills.clear();
+  }
+  _used = 0;
+  _spilled = 0;
+}
+
+uint8_t* MediaKeySession::Arena::Allocate(const uint32_t size) {
+  // Keep every allocation 16 byte aligned, for the IVs and the AES blocks.
+  const uint32_t aligned = (size + 15) & ~static_cast<uint32_t>(15);
+  uint8_t* result;
+
+  if ((_size - _used) >= aligned) {
+    result = &(_block[_used]);
+    _used += aligned;
+  }
+  else {
+    _spills.emplace_back(new uint8_t[aligned]);
+    _spilled += aligned;
+    result = _spills.back().get();
+  }
+  return (result);
+}
+
 
 void MediaKeySession::Run(const IMediaKeySessionCallback *f_piMediaKeySessionCallback) {
 
   if (f_piMediaKeySessionCallback) {
+    m_callbackLock.Lock();
+    m_lock.Lock();
     m_piCallback = const_cast<IMediaKeySessionCallback*>(f_piMediaKeySessionCallback);
+    const bool requested = m_requested;
+    const PSSH::KeyIds sharedKeyIds (m_sharedKeyIds);
+    std::string message;
+    std::string destUrl;
+    message.swap(m_pendingMessage);
+    destUrl.swap(m_pendingUrl);
+    m_lock.Unlock();
+
+    if (sharedKeyIds.empty() == false) {
+      // The keys come from another session, no license request needed.
+      for (PSSH::KeyIds::const_iterator keyId = sharedKeyIds.begin(); (keyId != sharedKeyIds.end()) && (attached() == true); keyId++) {
+        m_piCallback.load()->OnKeyStatusUpdate("KeyUsable", keyId->bytes, sizeof(keyId->bytes));
+      }
+      if (attached() == true) {
+        m_piCallback.load()->OnKeyStatusesUpdated();
+      }
+    }
+    else if (requested == true) {
+      // Prefetched: replay what happened before the application attached.
+      if (message.empty() == false) {
+        m_piCallback.load()->OnKeyMessage((const uint8_t*) message.c_str(), message.size(), (char*) destUrl.c_str());
+      }
+      onKeyStatusChange();
+    }
+    m_callbackLock.Unlock();
 
-    widevine::Cdm::Status status = m_cdm->generateRequest(m_sessionId, m_initDataType, m_initData);
-    if (widevine::Cdm::kSuccess != status) {
-       printf("generateRequest failed\n");
-       m_piCallback->OnKeyMessage((const uint8_t *) "", 0, "");
+    if ((sharedKeyIds.empty() == true) && (requested == false)) {
+      generateRequest();
     }
   }
   else {
-      m_piCallback = nullptr;
+    detach();
+  }
+}
+
+// Called without session locks held. The request message comes back
+// through the event dispatcher.
+void MediaKeySession::generateRequest() {
+  g_cdmLock.Lock();
+  widevine::Cdm::Status status = m_cdm->generateRequest(m_sessionId, m_initDataType, m_initData);
+  g_cdmLock.Unlock();
+
+  if (widevine::Cdm::kSuccess != status) {
+    printf("generateRequest failed\n");
+    m_callbackLock.Lock();
+    if (attached() == true) {
+      m_piCallback.load()->OnKeyMessage((const uint8_t *) "", 0, "");
+    }
+    m_callbackLock.Unlock();
   }
 }
 
+void MediaKeySession::detach() {
+  // Otherwise the dispatch thread may take the lock again and again for
+  // the next events.
+  m_detaching++;
+  m_callbackLock.Lock();
+  m_lock.Lock();
+  m_piCallback = nullptr;
+  m_lock.Unlock();
+  m_callbackLock.Unlock();
+  m_detaching--;
+}
+
+bool MediaKeySession::prefetch() {
+  // The request message comes back on this thread, from within
+  // generateRequest, and is kept by onMessage.
+  m_lock.Lock();
+  m_requested = true;
+  m_lock.Unlock();
+
+  g_cdmLock.Lock();
+  widevine::Cdm::Status status = m_cdm->generateRequest(m_sessionId, m_initDataType, m_initData);
+  g_cdmLock.Unlock();
+
+  if (widevine::Cdm::kSuccess != status) {
+    printf("generateRequest failed\n");
+    m_lock.Lock();
+    m_requested = false;
+    m_lock.Unlock();
+  }
+  return (widevine::Cdm::kSuccess == status);
+}
+
+void MediaKeySession::share(const std::shared_ptr<MediaKeySession>& donor, const PSSH::KeyIds& keyIds) {
+  ASSERT((donor != nullptr) && (donor->shared() == false));
+
+  m_lock.Lock();
+  m_donor = donor;
+  m_sharedKeyIds = keyIds;
+  m_shared = true;
+  m_lock.Unlock();
+}
+
+// On the dispatch thread, without locks held. A donor that is retired, or
+// whose keys expired or were released, no longer lends them: the keys are
+// reported pending and the session requests its own license.
+void MediaKeySession::checkDonor() {
+  PSSH::KeyIds lost;
+
+  m_lock.Lock();
+  if (m_sharedKeyIds.empty() == false) {
+    std::shared_ptr<MediaKeySession> donor (m_donor.lock());
+
+    if ((donor == nullptr) || (donor->retired() == true) || (donor->hasUsableKeys(m_sharedKeyIds) == false)) {
+      lost.swap(m_sharedKeyIds);
+      m_donor.reset();
+      m_shared = false;
+    }
+  }
+  m_lock.Unlock();
+
+  if (lost.empty() == false) {
+    TRACE_L1("Session %s: lost the keys it shared", m_sessionId.c_str());
+
+    m_callbackLock.Lock();
+    for (PSSH::KeyIds::const_iterator keyId = lost.begin(); (keyId != lost.end()) && (attached() == true); keyId++) {
+      m_piCallback.load()->OnKeyStatusUpdate("KeyStatusPending", keyId->bytes, sizeof(keyId->bytes));
+    }
+    const bool request = attached();
+    if (request == true) {
+      m_piCallback.load()->OnKeyStatusesUpdated();
+    }
+    m_callbackLock.Unlock();
+
+    // Not yet attached, Run requests the license.
+    if (request == true) {
+      generateRequest();
+    }
+  }
+}
+
+void MediaKeySession::usableKeyIds(PSSH::KeyIds& keyIds) {
+  keyIds.clear();
+
+  m_lock.Lock();
+  if ((m_keyStatusesValid.load() == true) || (refreshKeyStatuses() == true)) {
+    for (const KeyStatusEntry& entry : m_keyStatuses) {
+      if ((entry.status == widevine::Cdm::kUsable) && (entry.keyIdLength == sizeof(PSSH::KeyId::bytes))) {
+        keyIds.emplace_back();
+        ::memcpy(keyIds.back().bytes, entry.keyId, entry.keyIdLength);
+      }
+    }
+  }
+  m_lock.Unlock();
+}
+
+bool MediaKeySession::hasUsableKeys(const PSSH::KeyIds& keyIds) {
+  bool result = true;
+
+  m_lock.Lock();
+  if ((m_keyStatusesValid.load() == true) || (refreshKeyStatuses() == true)) {
+    for (PSSH::KeyIds::const_iterator index = keyIds.begin(); (index != keyIds.end()) && (result == true); index++) {
+      const KeyStatusEntry* entry = findKeyStatus(sizeof(index->bytes), index->bytes);
+      result = ((entry != nullptr) && (entry->status == widevine::Cdm::kUsable));
+    }
+  }
+  else {
+    result = false;
+  }
+  m_lock.Unlock();
+
+  return (result);
+}
+
+// Called by a session that shares our keys, with its own m_lock held. A
+// donor never shares keys itself, so the locks always nest in this order.
+bool MediaKeySession::sharedKey(const uint8_t keyIdLength, const uint8_t* keyId, KeyStatusEntry& key) {
+  bool result = false;
+
+  m_lock.Lock();
+  if ((m_keyStatusesValid.load() == true) || (refreshKeyStatuses() == true)) {
+    const KeyStatusEntry* entry = findKeyStatus(keyIdLength, keyId);
+
+    if ((entry != nullptr) && (entry->status == widevine::Cdm::kUsable)) {
+      key = *entry;
+      result = true;
+    }
+  }
+  m_lock.Unlock();
+
+  return (result);
+}
+
+bool MediaKeySession::pendingMessage(std::string& message) {
+  m_lock.Lock();
+  message = m_pendingMessage;
+  m_lock.Unlock();
+  return (message.empty() == false);
+}
+
 void MediaKeySession::onMessage(widevine::Cdm::MessageType f_messageType, const std::string& f_message) {
-  std::string destUrl;
-  std::string message;
+  // "<type>:Type:" fits a small fixed buffer, the message is laid out in a
+  // buffer the session keeps, so renewals do not allocate.
+  char prefix[16];
+  int prefixLength = 0;
+  const char* destUrl = "";
 
   switch (f_messageType) {
   case widevine::Cdm::kLicenseRequest:
   case widevine::Cdm::kLicenseRenewal:
   case widevine::Cdm::kLicenseRelease:
   {
-    destUrl.assign(kLicenseServer); 
+    destUrl = kLicenseServer.c_str();
 
     // FIXME: Errrr, this is weird.
     //if ((Cdm::MessageType)f_message[1] == (Cdm::kIndividualizationRequest + 1)) {
     //  LOGI("switching message type to kIndividualizationRequest");
     //  messageType = Cdm::kIndividualizationRequest;
     //}
-    
-    message = std::to_string(f_messageType) + ":Type:";
+
+    prefixLength = ::snprintf(prefix, sizeof(prefix), "%d:Type:", static_cast<int>(f_messageType));
     break;
   }
   default:
     printf("unsupported message type %d\n", f_messageType);
     break;
   }
-  message.append(f_message.c_str(),  f_message.size());
-  m_piCallback->OnKeyMessage((const uint8_t*) message.c_str(), message.size(), (char*) destUrl.c_str());
+
+  // Prefetched sessions keep the message until the application attaches,
+  // Run takes it over under m_lock.
+  m_lock.Lock();
+  const bool keep = ((m_piCallback.load() == nullptr) && (m_requested == true));
+
+  if (keep == true) {
+    m_pendingMessage.reserve(prefixLength + f_message.size());
+    m_pendingMessage.assign(prefix, prefixLength);
+    m_pendingMessage.append(f_message);
+    m_pendingUrl.assign(destUrl);
+  }
+  m_lock.Unlock();
+
+  if (keep == false) {
+    m_callbackLock.Lock();
+
+    IMediaKeySessionCallback* callback = (attached() == true ? m_piCallback.load() : nullptr);
+
+    if (callback != nullptr) {
+      m_message.reserve(prefixLength + f_message.size());
+      m_message.assign(prefix, prefixLength);
+      m_message.append(f_message);
+
+      const uint64_t start = Metrics::Timestamp();
+      callback->OnKeyMessage(reinterpret_cast<const uint8_t*>(m_message.data()), m_message.size(), const_cast<char*>(destUrl));
+      m_metrics.Measure(Metrics::MESSAGE, start);
+    }
+
+    m_callbackLock.Unlock();
+  }
+}
+
+static widevine::Cdm::EncryptionScheme cdmEncryptionScheme(const EncryptionScheme encryptionScheme)
+{
+    switch (encryptionScheme) {
+    case AesCtr_Cenc:
+    case AesCtr_Cens:
+        return widevine::Cdm::kAesCtr;
+    case AesCbc_Cbc1:
+    case AesCbc_Cbcs:
+        return widevine::Cdm::kAesCbc;
+    default:
+        return widevine::Cdm::kClear;
+    }
+}
+
+// Number of 16 byte blocks the pattern encrypts in a protected run. Trailing
+// partial blocks are never encrypted.
+static uint64_t encryptedBlocks(const EncryptionPattern& pattern, const uint32_t length)
+{
+    const uint64_t blocks = length / 16;
+    const uint64_t cycle = pattern.encrypted_blocks + pattern.clear_blocks;
+
+    if ((pattern.encrypted_blocks == 0) || (cycle == 0)) {
+        return blocks;
+    }
+
+    const uint64_t remainder = blocks % cycle;
+    return ((blocks / cycle) * pattern.encrypted_blocks) + std::min<uint64_t>(remainder, pattern.encrypted_blocks);
+}
+
+// AES-CTR in CENC counts in the lower 64 bits of the IV, big endian.
+static void incrementCounter(uint8_t iv[], uint64_t blocks)
+{
+    for (int index = 15; (index >= 8) && (blocks != 0); index--) {
+        const uint64_t sum = static_cast<uint64_t>(iv[index]) + (blocks & 0xFF);
+        iv[index] = static_cast<uint8_t>(sum);
+        blocks = (blocks >> 8) + (sum >> 8);
+    }
+}
+
+static void loadIV(uint8_t iv[], const uint8_t* source, const uint32_t length)
+{
+    ::memcpy(iv, source, (length > 16 ? 16 : length));
+    if (length < 16) {
+        ::memset(&(iv[length]), 0, 16 - length);
+    }
 }
 
 static const char* widevineKeyStatusToCString(widevine::Cdm::KeyStatus widevineStatus)
@@ -131,21 +494,240 @@ static const char* widevineKeyStatusToCString(widevine::Cdm::KeyStatus widevineS
     }
 }
 
-void MediaKeySession::onKeyStatusChange()
+void MediaKeySession::invalidateKeyStatuses()
+{
+    m_keyStatusesValid.store(false);
+
+    // Let the waiters look again.
+    std::unique_lock<std::mutex> lock(m_keyWaitLock);
+    m_keyGeneration++;
+    m_keyWait.notify_all();
+}
+
+// Takes m_lock, unlike usableKey this does not count as a decrypt lookup.
+bool MediaKeySession::keyUsable(const uint8_t keyIdLength, const uint8_t* keyId)
+{
+    bool result = false;
+
+    m_lock.Lock();
+
+    if ((m_keyStatusesValid.load() == true) || (refreshKeyStatuses() == true)) {
+        const KeyStatusEntry* entry = findKeyStatus(keyIdLength, keyId);
+        result = ((entry != nullptr) && (entry->status == widevine::Cdm::kUsable));
+    }
+
+    if ((result == false) && (m_sharedKeyIds.empty() == false)) {
+        std::shared_ptr<MediaKeySession> donor (m_donor.lock());
+        KeyStatusEntry entry;
+
+        result = ((donor != nullptr) && (donor->sharedKey(keyIdLength, keyId, entry) == true));
+    }
+
+    m_lock.Unlock();
+
+    return (result);
+}
+
+CDMi_RESULT MediaKeySession::WaitForKey(
+    const uint8_t keyIdLength,
+    const uint8_t* keyId,
+    const uint32_t waitTime)
+{
+    const std::chrono::steady_clock::time_point deadline (std::chrono::steady_clock::now() + std::chrono::milliseconds(waitTime));
+
+    std::unique_lock<std::mutex> lock(m_keyWaitLock);
+    const uint32_t cancel = m_keyWaitCancel;
+
+    if (m_keyWaitClosed == true) {
+        return (CDMi_S_FALSE);
+    }
+
+    // Counted, so retire can tell when the last one left.
+    m_keyWaiters++;
+    CDMi_RESULT result = CDMi_S_FALSE;
+
+    while (true) {
+        // Taken before looking, so a change during the lookup is not missed.
+        const uint32_t generation = m_keyGeneration;
+
+        lock.unlock();
+        const bool usable = keyUsable(keyIdLength, keyId);
+        lock.lock();
+
+        if (usable == true) {
+            result = CDMi_SUCCESS;
+            break;
+        }
+
+        const bool signalled = m_keyWait.wait_until(lock, deadline, [this, generation, cancel]() {
+            return ((m_keyGeneration != generation) || (m_keyWaitCancel != cancel));
+        });
+
+        if ((signalled == false) || (m_keyWaitCancel != cancel)) {
+            break;
+        }
+    }
+
+    // The last thing done with the session.
+    if (--m_keyWaiters == 0) {
+        m_keyWait.notify_all();
+    }
+    return (result);
+}
+
+void MediaKeySession::CancelWaitForKey()
+{
+    std::unique_lock<std::mutex> lock(m_keyWaitLock);
+    m_keyWaitCancel++;
+    m_keyWait.notify_all();
+}
+
+void MediaKeySession::retire()
 {
+    m_retired = true;
+
+    std::unique_lock<std::mutex> lock(m_keyWaitLock);
+    m_keyWaitClosed = true;
+    m_keyWaitCancel++;
+    m_keyWait.notify_all();
+    m_keyWait.wait(lock, [this]() { return (m_keyWaiters == 0); });
+}
+
+// Must be called with m_lock held.
+bool MediaKeySession::refreshKeyStatuses()
+{
+    // Mark valid before fetching, so an invalidation racing with the fetch
+    // is not lost.
+    m_keyStatusesValid.store(true);
+
     widevine::Cdm::KeyStatusMap map;
-    if (widevine::Cdm::kSuccess != m_cdm->getKeyStatuses(m_sessionId, &map))
-        return;
+    if (widevine::Cdm::kSuccess != m_cdm->getKeyStatuses(m_sessionId, &map)) {
+        m_keyStatusesValid.store(false);
+        return false;
+    }
+
+    m_keyStatuses.clear();
+    m_keyStatuses.reserve(map.size());
 
     for (const auto& pair : map) {
-        const std::string& keyValue = pair.first;
-        widevine::Cdm::KeyStatus keyStatus = pair.second;
+        if (pair.first.length() > KeyIdSize) {
+            TRACE_L1("Ignoring key id of %u bytes", static_cast<uint32_t>(pair.first.length()));
+            continue;
+        }
+        KeyStatusEntry entry;
+        ::memset(entry.keyId, 0, sizeof(entry.keyId));
+        ::memcpy(entry.keyId, pair.first.data(), pair.first.length());
+        entry.keyIdLength = static_cast<uint8_t>(pair.first.length());
+        entry.status = pair.second;
+        m_keyStatuses.push_back(entry);
+    }
+    return true;
+}
+
+// Must be called with m_lock held. Without a key id the first usable key
+// is used, or the first key if none is usable.
+const MediaKeySession::KeyStatusEntry* MediaKeySession::findKeyStatus(const uint8_t keyIdLength, const uint8_t* keyId) const
+{
+    const KeyStatusEntry* result = nullptr;
 
-        m_piCallback->OnKeyStatusUpdate(widevineKeyStatusToCString(keyStatus),
-                                        reinterpret_cast<const uint8_t*>(keyValue.c_str()),
-                                        keyValue.length());
+    if (keyIdLength == 0) {
+        for (const KeyStatusEntry& entry : m_keyStatuses) {
+            if (entry.status == widevine::Cdm::kUsable) {
+                result = &entry;
+                break;
+            }
+        }
+        if ((result == nullptr) && (m_keyStatuses.empty() == false)) {
+            result = &m_keyStatuses.front();
+        }
+    } else if (keyIdLength <= KeyIdSize) {
+        for (const KeyStatusEntry& entry : m_keyStatuses) {
+            if ((entry.keyIdLength == keyIdLength) && (::memcmp(entry.keyId, keyId, keyIdLength) == 0)) {
+                result = &entry;
+                break;
+            }
+        }
     }
-    m_piCallback->OnKeyStatusesUpdated();
+    return result;
+}
+
+// Must be called with m_lock held.
+const MediaKeySession::KeyStatusEntry* MediaKeySession::usableKey(const uint8_t keyIdLength, const uint8_t* keyId)
+{
+    const uint64_t start = Metrics::Timestamp();
+    const KeyStatusEntry* result = nullptr;
+
+    if ((m_keyStatusesValid.load() == true) || (refreshKeyStatuses() == true)) {
+        // FIXME: Without a key id we just use the first key? How do we know that's the Widevine key and not, say, a PlayReady one?
+        result = findKeyStatus(keyIdLength, keyId);
+
+        if ((result != nullptr) && (result->status != widevine::Cdm::kUsable)) {
+            result = nullptr;
+        }
+    }
+
+    if ((result == nullptr) && (m_sharedKeyIds.empty() == false)) {
+        // The decrypt itself does not care which session loaded the key.
+        std::shared_ptr<MediaKeySession> donor (m_donor.lock());
+
+        if ((donor != nullptr) && (donor->sharedKey(keyIdLength, keyId, m_sharedKey) == true)) {
+            result = &m_sharedKey;
+        }
+    }
+
+    m_metrics.Measure(Metrics::KEY_LOOKUP, start);
+
+    if (result == nullptr) {
+        m_metrics.NoKey();
+    }
+    return result;
+}
+
+// Reports only the keys whose status differs from what the application
+// was told last, followed by a single OnKeyStatusesUpdated. The statuses
+// are taken under m_lock, the callbacks are made after releasing it.
+void MediaKeySession::onKeyStatusChange()
+{
+    if (shared() == true) {
+        checkDonor();
+    }
+
+    m_callbackLock.Lock();
+
+    if (attached() == true) {
+        m_lock.Lock();
+        const bool refreshed = refreshKeyStatuses();
+        if (refreshed == true) {
+            m_keyStatusReport = m_keyStatuses;
+        }
+        m_lock.Unlock();
+
+        bool changed = false;
+
+        // A callback may detach the session, see detach().
+        for (KeyStatusTable::const_iterator entry = m_keyStatusReport.begin(); (refreshed == true) && (entry != m_keyStatusReport.end()) && (attached() == true); entry++) {
+            KeyStatusTable::const_iterator reported (m_reportedKeyStatuses.begin());
+
+            while ((reported != m_reportedKeyStatuses.end()) &&
+                   ((reported->keyIdLength != entry->keyIdLength) || (::memcmp(reported->keyId, entry->keyId, entry->keyIdLength) != 0))) {
+                reported++;
+            }
+
+            if ((reported == m_reportedKeyStatuses.end()) || (reported->status != entry->status)) {
+                m_piCallback.load()->OnKeyStatusUpdate(widevineKeyStatusToCString(entry->status),
+                                                entry->keyId,
+                                                entry->keyIdLength);
+                changed = true;
+            }
+        }
+
+        if ((changed == true) && (attached() == true)) {
+            m_reportedKeyStatuses = m_keyStatusReport;
+            m_piCallback.load()->OnKeyStatusesUpdated();
+        }
+    }
+
+    m_callbackLock.Unlock();
 }
 
 void MediaKeySession::onKeyStatusError(widevine::Cdm::Status status) {
@@ -173,21 +755,45 @@ void MediaKeySession::onKeyStatusError(widevine::Cdm::Status status) {
     errorStatus = "UnExpectedError";
     break;
   }
-  m_piCallback->OnError(0, CDMi_S_FALSE, errorStatus.c_str());
+  // Called without m_lock held.
+  m_callbackLock.Lock();
+  IMediaKeySessionCallback* callback = (attached() == true ? m_piCallback.load() : nullptr);
+  if (callback == nullptr) {
+    TRACE_L1("Session %s: %s", m_sessionId.c_str(), errorStatus.c_str());
+  }
+  else {
+    callback->OnError(0, CDMi_S_FALSE, errorStatus.c_str());
+  }
+  m_callbackLock.Unlock();
 }
 
 void MediaKeySession::onRemoveComplete() {
-    widevine::Cdm::KeyStatusMap map;
-    if (widevine::Cdm::kSuccess == m_cdm->getKeyStatuses(m_sessionId, &map)) {
-        for (const auto& pair : map) {
-            const std::string& keyValue = pair.first;
+    m_callbackLock.Lock();
 
-            m_piCallback->OnKeyStatusUpdate("KeyReleased",
-                                        reinterpret_cast<const uint8_t*>(keyValue.c_str()),
-                                        keyValue.length());
+    if (attached() == true) {
+        m_lock.Lock();
+        const bool refreshed = refreshKeyStatuses();
+        if (refreshed == true) {
+            m_reportedKeyStatuses = m_keyStatuses;
+        }
+        m_lock.Unlock();
+
+        if (refreshed == true) {
+            for (KeyStatusEntry& entry : m_reportedKeyStatuses) {
+                entry.status = widevine::Cdm::kReleased;
+            }
+            for (KeyStatusTable::const_iterator entry = m_reportedKeyStatuses.begin(); (entry != m_reportedKeyStatuses.end()) && (attached() == true); entry++) {
+                m_piCallback.load()->OnKeyStatusUpdate("KeyReleased",
+                                            entry->keyId,
+                                            entry->keyIdLength);
+            }
+            if (attached() == true) {
+                m_piCallback.load()->OnKeyStatusesUpdated();
+            }
         }
-        m_piCallback->OnKeyStatusesUpdated();
     }
+
+    m_callbackLock.Unlock();
 }
 
 void MediaKeySession::onDeferredComplete(widevine::Cdm::Status) {
@@ -198,48 +804,76 @@ void MediaKeySession::onDirectIndividualizationRequest(const string&) {
 
 CDMi_RESULT MediaKeySession::Load(void) {
   CDMi_RESULT ret = CDMi_S_FALSE;
-  g_lock.Lock();
+  m_lock.Lock();
+  g_cdmLock.Lock();
+  const uint64_t start = Metrics::Timestamp();
   widevine::Cdm::Status status = m_cdm->load(m_sessionId);
+  m_metrics.Measure(Metrics::LOAD, start);
+  g_cdmLock.Unlock();
   if (widevine::Cdm::kSuccess != status)
-    onKeyStatusError(status);
+    m_metrics.Failed(status);
   else
     ret = CDMi_SUCCESS;
-  g_lock.Unlock();
+  m_lock.Unlock();
+  // The application hears about it outside of m_lock.
+  if (widevine::Cdm::kSuccess != status)
+    onKeyStatusError(status);
   return ret;
 }
 
 void MediaKeySession::Update(
     const uint8_t *f_pbKeyMessageResponse,
     uint32_t f_cbKeyMessageResponse) {
-  std::string keyResponse(reinterpret_cast<const char*>(f_pbKeyMessageResponse),
+  m_lock.Lock();
+  // widevine::Cdm::update wants a std::string, reuse the session's buffer.
+  m_response.assign(reinterpret_cast<const char*>(f_pbKeyMessageResponse),
       f_cbKeyMessageResponse);
-  g_lock.Lock();
-  widevine::Cdm::Status status = m_cdm->update(m_sessionId, keyResponse);
+  const uint64_t start = Metrics::Timestamp();
+  g_cdmLock.Lock();
+  widevine::Cdm::Status status = m_cdm->update(m_sessionId, m_response);
+  g_cdmLock.Unlock();
+  m_metrics.Measure(Metrics::UPDATE, start);
+  if (widevine::Cdm::kSuccess == status) {
+     // The license request kept by prefetch is answered.
+     m_pendingMessage.clear();
+     m_pendingUrl.clear();
+     invalidateKeyStatuses();
+  }
+  else {
+     m_metrics.Failed(status);
+  }
+  m_lock.Unlock();
+  // The application hears about it outside of m_lock.
   if (widevine::Cdm::kSuccess == status)
      onKeyStatusChange();
   else
      onKeyStatusError(status);
-  g_lock.Unlock();
 }
 
 CDMi_RESULT MediaKeySession::Remove(void) {
   CDMi_RESULT ret = CDMi_S_FALSE;
-  g_lock.Lock();
+  m_lock.Lock();
+  g_cdmLock.Lock();
   widevine::Cdm::Status status = m_cdm->remove(m_sessionId);
+  g_cdmLock.Unlock();
+  if (widevine::Cdm::kSuccess == status)
+    ret =  CDMi_SUCCESS;
+  m_lock.Unlock();
   if (widevine::Cdm::kSuccess != status)
     onKeyStatusError(status);
-  else
-    ret =  CDMi_SUCCESS;
-  g_lock.Unlock();
   return ret;
 }
 
 CDMi_RESULT MediaKeySession::Close(void) {
   CDMi_RESULT status = CDMi_S_FALSE;
-  g_lock.Lock();
+  CancelWaitForKey();
+  detach();
+  m_lock.Lock();
+  g_cdmLock.Lock();
   if (widevine::Cdm::kSuccess == m_cdm->close(m_sessionId))
     status = CDMi_SUCCESS;
-  g_lock.Unlock();
+  g_cdmLock.Unlock();
+  m_lock.Unlock();
   return status;
 }
 
@@ -258,17 +892,7 @@ CDMi_RESULT MediaKeySession::Init(
     uint32_t f_cbInitData,
     const uint8_t *f_pbCDMData,
     uint32_t f_cbCDMData) {
-  switch ((LicenseType)licenseType) {
-  case PersistentUsageRecord:
-    m_licenseType = widevine::Cdm::kPersistentUsageRecord;
-    break;
-  case PersistentLicense:
-    m_licenseType = widevine::Cdm::kPersistentLicense;
-    break;
-  default:
-    m_licenseType = widevine::Cdm::kTemporary;
-    break;
-  }
+  m_licenseType = sessionType(licenseType);
 
   if (f_pwszInitDataType) {
     if (!strcmp(f_pwszInitDataType, "cenc"))
@@ -285,6 +909,115 @@ CDMi_RESULT MediaKeySession::Init(
   return CDMi_SUCCESS;
 }
 
+// Must be called with m_lock held. Input and output may be the same buffer.
+bool MediaKeySession::decryptRange(
+    const KeyStatusEntry& key,
+    const EncryptionScheme encryptionScheme,
+    const EncryptionPattern& pattern,
+    const uint8_t iv[],
+    const uint8_t* input,
+    uint8_t* output,
+    uint32_t length)
+{
+  widevine::Cdm::OutputBuffer outputBuffer;
+  outputBuffer.data = output;
+  outputBuffer.data_length = length;
+
+  widevine::Cdm::InputBuffer inputBuffer;
+  inputBuffer.data = input;
+  inputBuffer.data_length = length;
+  inputBuffer.key_id = key.keyId;
+  inputBuffer.key_id_length = key.keyIdLength;
+  inputBuffer.iv = iv;
+  inputBuffer.iv_length = 16;
+  inputBuffer.pattern.encrypted_blocks = pattern.encrypted_blocks;
+  inputBuffer.pattern.clear_blocks = pattern.clear_blocks;
+  inputBuffer.encryption_scheme = cdmEncryptionScheme(encryptionScheme);
+
+  const uint64_t start = Metrics::Timestamp();
+  const widevine::Cdm::Status status = m_cdm->decrypt(inputBuffer, outputBuffer);
+  m_metrics.Measure(Metrics::CDM_DECRYPT, start);
+
+  if (status != widevine::Cdm::kSuccess) {
+    m_metrics.Failed(status);
+    return (false);
+  }
+
+  m_metrics.Decrypted(length);
+  return (true);
+}
+
+// Must be called with m_lock held. Unpatterned ranges that are large
+// enough are split over the decrypt engine.
+bool MediaKeySession::decryptLarge(
+    const KeyStatusEntry& key,
+    const EncryptionScheme encryptionScheme,
+    const EncryptionPattern& pattern,
+    const uint8_t iv[],
+    const uint8_t* input,
+    uint8_t* output,
+    uint32_t length)
+{
+  struct Range {
+    MediaKeySession* session;
+    const KeyStatusEntry* key;
+    EncryptionScheme encryptionScheme;
+    const EncryptionPattern* pattern;
+    uint8_t iv[16];
+    const uint8_t* input;
+    uint8_t* output;
+    uint32_t length;
+  };
+
+  const bool patterned = ((pattern.encrypted_blocks != 0) || (pattern.clear_blocks != 0));
+  uint32_t chunks = (m_engine != nullptr ? std::min<uint32_t>(m_engine->Threads() + 1, length / DecryptEngine::MinimumChunk) : 0);
+
+  if ((patterned == true) || (chunks < 2)) {
+    return (decryptRange(key, encryptionScheme, pattern, iv, input, output, length));
+  }
+
+  const bool counter = (cdmEncryptionScheme(encryptionScheme) == widevine::Cdm::kAesCtr);
+  // Whole blocks only, the tail goes with the last chunk.
+  const uint32_t chunk = ((length / chunks) & ~static_cast<uint32_t>(15));
+  Range* ranges = m_arena.Allocate<Range>(chunks);
+
+  // The CBC IVs are the preceding ciphertext blocks, take them before any
+  // range is decrypted in place.
+  for (uint32_t index = 0; index < chunks; index++) {
+    Range& range(ranges[index]);
+    range.session = this;
+    range.key = &key;
+    range.encryptionScheme = encryptionScheme;
+    range.pattern = &pattern;
+    range.input = &(input[chunk * index]);
+    range.output = &(output[chunk * index]);
+    range.length = (index == (chunks - 1) ? length - (chunk * index) : chunk);
+
+    if (index == 0) {
+      ::memcpy(range.iv, iv, 16);
+    } else if (counter == true) {
+      ::memcpy(range.iv, iv, 16);
+      incrementCounter(range.iv, (static_cast<uint64_t>(chunk) * index) / 16);
+    } else {
+      ::memcpy(range.iv, range.input - 16, 16);
+    }
+  }
+
+  DecryptEngine::Completion completion;
+
+  for (uint32_t index = 1; index < chunks; index++) {
+    const Range* range = &(ranges[index]);
+
+    m_engine->Submit(completion, [range]() {
+      return (range->session->decryptRange(*range->key, range->encryptionScheme, *range->pattern, range->iv, range->input, range->output, range->length));
+    });
+  }
+
+  const bool result = decryptRange(key, encryptionScheme, pattern, ranges[0].iv, input, output, ranges[0].length);
+
+  return ((m_engine->Complete(completion) == true) && (result == true));
+}
+
 CDMi_RESULT MediaKeySession::Decrypt(
     const uint8_t *f_pbSessionKey VARIABLE_IS_NOT_USED,
     uint32_t f_cbSessionKey VARIABLE_IS_NOT_USED,
@@ -298,70 +1031,328 @@ CDMi_RESULT MediaKeySession::Decrypt(
     uint8_t **f_ppbOpaqueClearContent,
     const uint8_t keyIdLength,
     const uint8_t* keyId,
-    bool /* initWithLast15 */)
+    bool initWithLast15)
 {
-  g_lock.Lock();
-  widevine::Cdm::KeyStatusMap map;
-  std::string keyStatus;
+  if (cdmEncryptionScheme(encryptionScheme) == widevine::Cdm::kClear) {
+    // Clear (lead) samples need neither the lock, a usable key nor the CDM.
+    *f_ppbOpaqueClearContent = f_pbData;
+    *f_pcbOpaqueClearContent = f_cbData;
+    return CDMi_SUCCESS;
+  }
+
+  const uint64_t start = Metrics::Timestamp();
+  m_lock.Lock();
+  m_metrics.Measure(Metrics::LOCK_WAIT, start);
+  m_arena.Reset();
 
   CDMi_RESULT status = CDMi_S_FALSE;
   *f_pcbOpaqueClearContent = 0;
 
-  memcpy(m_IV, f_pbIV, (f_cbIV > 16 ? 16 : f_cbIV));
-  if (f_cbIV < 16) {
-    memset(&(m_IV[f_cbIV]), 0, 16 - f_cbIV);
+  // A new sample starts from its IV, a continuation from where the
+  // previous chunk of the sample with the same key id stopped.
+  Stream* stream = findStream(keyIdLength, keyId, (initWithLast15 == false));
+
+  if ((initWithLast15 == false) && (stream != nullptr)) {
+    stream->encryptionScheme = encryptionScheme;
+    stream->pattern = pattern;
+    loadIV(stream->iv, f_pbIV, f_cbIV);
+    stream->offset = 0;
+    stream->valid = true;
   }
 
-  if (widevine::Cdm::kSuccess == m_cdm->getKeyStatuses(m_sessionId, &map)) {
-    widevine::Cdm::KeyStatusMap::iterator it;
-    if(keyIdLength > 0) {
-      // if keyid is provided, find it in the map
-      std::string keyIdString((const char*) keyId, (size_t) keyIdLength);
-      it = map.find(keyIdString);
-    } else {
-      // if no keyid is provided, use the first one in the map
-      it = map.begin();
-    }
-
-    // FIXME: We just check the first key? How do we know that's the Widevine key and not, say, a PlayReady one?
-    if (widevine::Cdm::kUsable == it->second) {
-      // Decrypt content in place of input buffer. 
-      widevine::Cdm::OutputBuffer output;
-      output.data = const_cast<uint8_t*>(f_pbData);
-      output.data_length = f_cbData;
-
-      widevine::Cdm::InputBuffer input;
-      input.data = f_pbData;
-      input.data_length = f_cbData;
-      input.key_id = reinterpret_cast<const uint8_t*>((it->first).c_str());
-      input.key_id_length = (it->first).size();
-      input.iv = m_IV;
-      input.iv_length = sizeof(m_IV);
-      input.pattern.encrypted_blocks = pattern.encrypted_blocks;
-      input.pattern.clear_blocks = pattern.clear_blocks;
-      switch (encryptionScheme) {
-          case AesCtr_Cenc:
-          case AesCtr_Cens:
-              input.encryption_scheme = widevine::Cdm::kAesCtr;
-              break;
-          case AesCbc_Cbc1:
-          case AesCbc_Cbcs:
-              input.encryption_scheme = widevine::Cdm::kAesCbc;
-              break;
-          default:
-              input.encryption_scheme = widevine::Cdm::kClear;
-              break;
+  const KeyStatusEntry* key = usableKey(keyIdLength, keyId);
+
+  if ((stream == nullptr) || (stream->valid == false)) {
+    TRACE_L1("Chunk of %u bytes does not continue a sample", f_cbData);
+  }
+  else if ((stream->encryptionScheme != encryptionScheme) || (stream->pattern.encrypted_blocks != pattern.encrypted_blocks) || (stream->pattern.clear_blocks != pattern.clear_blocks)) {
+    TRACE_L1("Chunk of %u bytes does not match the scheme of its sample", f_cbData);
+    stream->valid = false;
+  }
+  else if (key != nullptr) {
+    uint8_t iv[16];
+    const uint8_t offset = stream->offset;
+    ::memcpy(iv, stream->iv, sizeof(iv));
+
+    // Taken from the ciphertext, before it is decrypted in place.
+    stream->valid = continueStream(*stream, f_pbData, f_cbData);
+
+    // Straight into a slot of the output pool if possible, so the caller
+    // does not have to copy the clear sample again. In place otherwise.
+    uint8_t* output = m_outputPool.Acquire(f_cbData);
+
+    if (output == nullptr) {
+      output = f_pbData;
+    }
+
+    bool result = true;
+    uint32_t done = 0;
+
+    if (offset > 0) {
+      // The previous chunk ended within a counter block: finish that block
+      // through a temporary, the CDM only starts at block boundaries.
+      uint8_t block[16];
+      done = std::min<uint32_t>(16 - offset, f_cbData);
+
+      ::memset(block, 0, offset);
+      ::memcpy(&(block[offset]), f_pbData, done);
+      result = decryptRange(*key, encryptionScheme, pattern, iv, block, block, offset + done);
+      ::memcpy(output, &(block[offset]), done);
+      incrementCounter(iv, 1);
+    }
+
+    if ((result == true) && (done < f_cbData)) {
+      result = decryptLarge(*key, encryptionScheme, pattern, iv, &(f_pbData[done]), &(output[done]), f_cbData - done);
+    }
+
+    if (result == true) {
+      *f_ppbOpaqueClearContent = output;
+      *f_pcbOpaqueClearContent = f_cbData;
+      status = CDMi_SUCCESS;
+    }
+    else {
+      stream->valid = false;
+
+      if (output != f_pbData) {
+        m_outputPool.Release(output);
+      }
+    }
+  }
+  else {
+    stream->valid = false;
+  }
+
+  m_lock.Unlock();
+  return status;
+}
+
+// Must be called with m_lock held. The stream of the key id, for a new
+// sample (start) the least recently started one if there is none yet.
+// Key ids longer than KeyIdSize have no stream.
+MediaKeySession::Stream* MediaKeySession::findStream(const uint8_t keyIdLength, const uint8_t* keyId, const bool start)
+{
+  Stream* result = nullptr;
+
+  if (keyIdLength <= KeyIdSize) {
+    Stream* oldest = &(m_streams[0]);
+
+    for (uint8_t index = 0; index < MaxStreams; index++) {
+      Stream& stream(m_streams[index]);
+
+      if ((stream.started != 0) && (stream.keyIdLength == keyIdLength) && ((keyIdLength == 0) || (::memcmp(stream.keyId, keyId, keyIdLength) == 0))) {
+        result = &stream;
+        break;
+      }
+      if (stream.started < oldest->started) {
+        oldest = &stream;
+      }
+    }
+
+    if ((result == nullptr) && (start == true)) {
+      result = oldest;
+      if (keyIdLength > 0) {
+        ::memcpy(result->keyId, keyId, keyIdLength);
+      }
+      result->keyIdLength = keyIdLength;
+    }
+
+    if ((result != nullptr) && (start == true)) {
+      result->started = ++m_streamsStarted;
+    }
+  }
+
+  return (result);
+}
+
+// Must be called with m_lock held. Advances the stream state over a chunk
+// of ciphertext. Returns false if the next chunk cannot continue from it:
+// CBC needs whole blocks, patterned schemes whole pattern cycles.
+bool MediaKeySession::continueStream(
+    Stream& stream,
+    const uint8_t* data,
+    const uint32_t length)
+{
+  const EncryptionPattern& pattern(stream.pattern);
+  const uint32_t cycle = (pattern.encrypted_blocks != 0 ? pattern.encrypted_blocks + pattern.clear_blocks : 0) * 16;
+  bool result = false;
+
+  if (cdmEncryptionScheme(stream.encryptionScheme) == widevine::Cdm::kAesCtr) {
+    if (cycle == 0) {
+      const uint64_t total = static_cast<uint64_t>(stream.offset) + length;
+      incrementCounter(stream.iv, total / 16);
+      stream.offset = static_cast<uint8_t>(total % 16);
+      result = true;
+    }
+    else if ((stream.offset == 0) && ((length % cycle) == 0)) {
+      incrementCounter(stream.iv, encryptedBlocks(pattern, length));
+      result = true;
+    }
+  }
+  else if ((length >= 16) && (stream.offset == 0)) {
+    // CBC chains on from the last encrypted ciphertext block.
+    if (cycle == 0) {
+      if ((length % 16) == 0) {
+        ::memcpy(stream.iv, &(data[length - 16]), 16);
+        result = true;
+      }
+    }
+    else if ((length % cycle) == 0) {
+      ::memcpy(stream.iv, &(data[length - cycle + ((pattern.encrypted_blocks - 1) * 16)]), 16);
+      result = true;
+    }
+  }
+
+  return (result);
+}
+
+CDMi_RESULT MediaKeySession::DecryptSubSamples(
+    const EncryptionScheme encryptionScheme,
+    const EncryptionPattern& pattern,
+    const uint8_t *f_pbIV,
+    uint32_t f_cbIV,
+    uint8_t *f_pbData,
+    uint32_t f_cbData,
+    const SubSample* subSamples,
+    uint32_t subSampleCount,
+    const uint8_t keyIdLength,
+    const uint8_t* keyId)
+{
+  uint64_t total = 0;
+  uint32_t protectedBytes = 0;
+  uint32_t protectedRanges = 0;
+
+  for (uint32_t index = 0; index < subSampleCount; index++) {
+    total += subSamples[index].clearBytes + subSamples[index].encryptedBytes;
+    protectedBytes += subSamples[index].encryptedBytes;
+    protectedRanges += (subSamples[index].encryptedBytes > 0 ? 1 : 0);
+  }
+
+  if (total > f_cbData) {
+    TRACE_L1("Subsample map covers %llu bytes, sample has %u", static_cast<unsigned long long>(total), f_cbData);
+    return CDMi_S_FALSE;
+  }
+
+  if ((protectedRanges == 0) || (cdmEncryptionScheme(encryptionScheme) == widevine::Cdm::kClear)) {
+    // Nothing protected, the sample is already clear.
+    return CDMi_SUCCESS;
+  }
+
+  uint8_t iv[16];
+  loadIV(iv, f_pbIV, f_cbIV);
+
+  CDMi_RESULT status = CDMi_S_FALSE;
+
+  const uint64_t start = Metrics::Timestamp();
+  m_lock.Lock();
+  m_metrics.Measure(Metrics::LOCK_WAIT, start);
+  m_arena.Reset();
+
+  const KeyStatusEntry* key = usableKey(keyIdLength, keyId);
+
+  if (key != nullptr) {
+    // The scheme decides, not the pattern the caller passed along: a cbcs
+    // sample with a 0:0 pattern still restarts from the IV per subsample.
+    static const EncryptionPattern unpatterned = { 0, 0 };
+    const bool chained = ((encryptionScheme == AesCtr_Cenc) || (encryptionScheme == AesCbc_Cbc1));
+    const EncryptionPattern& runPattern (chained == true ? unpatterned : pattern);
+
+    if ((chained == true) && (protectedRanges > 1)) {
+      // cenc and cbc1: the protected runs form one continuous CTR stream or
+      // CBC chain, so gather them, decrypt once and scatter them back.
+      uint8_t* scratch = m_arena.Allocate(protectedBytes);
+
+      uint8_t* source = f_pbData;
+      uint8_t* destination = scratch;
+      for (uint32_t index = 0; index < subSampleCount; index++) {
+        source += subSamples[index].clearBytes;
+        ::memcpy(destination, source, subSamples[index].encryptedBytes);
+        source += subSamples[index].encryptedBytes;
+        destination += subSamples[index].encryptedBytes;
       }
-      if (widevine::Cdm::kSuccess == m_cdm->decrypt(input, output)) {
-        // Return decrypted content in place of the input buffer.
-        *f_ppbOpaqueClearContent = const_cast<uint8_t*>(f_pbData);
-        *f_pcbOpaqueClearContent = f_cbData;
+
+      if (decryptLarge(*key, encryptionScheme, runPattern, iv, scratch, scratch, protectedBytes) == true) {
+        destination = f_pbData;
+        source = scratch;
+        for (uint32_t index = 0; index < subSampleCount; index++) {
+          destination += subSamples[index].clearBytes;
+          ::memcpy(destination, source, subSamples[index].encryptedBytes);
+          destination += subSamples[index].encryptedBytes;
+          source += subSamples[index].encryptedBytes;
+        }
         status = CDMi_SUCCESS;
       }
+    } else {
+      // cens and cbcs (or a single protected run): the pattern restarts on
+      // every protected run. cbcs restarts from the constant IV, for cens
+      // the counter only advances over the blocks that were encrypted.
+      const bool counter = (cdmEncryptionScheme(encryptionScheme) == widevine::Cdm::kAesCtr);
+      uint8_t* data = f_pbData;
+
+      status = CDMi_SUCCESS;
+
+      for (uint32_t index = 0; (index < subSampleCount) && (status == CDMi_SUCCESS); index++) {
+        const uint32_t length = subSamples[index].encryptedBytes;
+
+        data += subSamples[index].clearBytes;
+
+        if (length > 0) {
+          if (decryptLarge(*key, encryptionScheme, runPattern, iv, data, data, length) == false) {
+            status = CDMi_S_FALSE;
+          } else if (counter == true) {
+            incrementCounter(iv, encryptedBlocks(runPattern, length));
+          }
+        }
+        data += length;
+      }
+    }
+  }
+
+  m_lock.Unlock();
+
+  return status;
+}
+
+CDMi_RESULT MediaKeySession::DecryptSamples(
+    const EncryptionScheme encryptionScheme,
+    const EncryptionPattern& pattern,
+    const Sample* samples,
+    uint32_t sampleCount,
+    const uint8_t keyIdLength,
+    const uint8_t* keyId)
+{
+  if (cdmEncryptionScheme(encryptionScheme) == widevine::Cdm::kClear) {
+    return CDMi_SUCCESS;
+  }
+
+  CDMi_RESULT status = CDMi_S_FALSE;
+
+  const uint64_t start = Metrics::Timestamp();
+  m_lock.Lock();
+  m_metrics.Measure(Metrics::LOCK_WAIT, start);
+
+  const KeyStatusEntry* key = usableKey(keyIdLength, keyId);
+
+  if (key != nullptr) {
+    uint8_t iv[16];
+
+    status = CDMi_SUCCESS;
+
+    for (uint32_t index = 0; (index < sampleCount) && (status == CDMi_SUCCESS); index++) {
+      const Sample& sample(samples[index]);
+
+      if (sample.length > 0) {
+        loadIV(iv, sample.iv, sample.ivLength);
+
+        if (decryptRange(*key, encryptionScheme, pattern, iv, sample.data, sample.data, sample.length) == false) {
+          TRACE_L1("Decrypting sample %u of %u failed", index, sampleCount);
+          status = CDMi_S_FALSE;
+        }
+      }
     }
   }
 
-  g_lock.Unlock();
+  m_lock.Unlock();
+
   return status;
 }
 
@@ -369,9 +1360,18 @@ CDMi_RESULT MediaKeySession::ReleaseClearContent(
     const uint8_t *f_pbSessionKey VARIABLE_IS_NOT_USED,
     uint32_t f_cbSessionKey VARIABLE_IS_NOT_USED,
     const uint32_t  f_cbClearContentOpaque VARIABLE_IS_NOT_USED,
-    uint8_t  *f_pbClearContentOpaque VARIABLE_IS_NOT_USED) {
-  //There is nothing to free due to in-place decryption
+    uint8_t  *f_pbClearContentOpaque ) {
+  // Content decrypted in place has nothing to free, a pool slot goes back.
+  m_outputPool.Release(f_pbClearContentOpaque);
   return CDMi_SUCCESS;
 }
 
+CDMi_RESULT MediaKeySession::RegisterOutputPool(uint8_t* buffer, const uint32_t slotSize, const uint8_t slotCount) {
+  return (m_outputPool.Register(buffer, slotSize, slotCount) == true ? CDMi_SUCCESS : CDMi_S_FALSE);
+}
+
+CDMi_RESULT MediaKeySession::UnregisterOutputPool() {
+  return (m_outputPool.Unregister() == true ? CDMi_SUCCESS : CDMi_S_FALSE);
+}
+
 }  // namespace CDMi
@@ -18,21 +18,69 @@
 #pragma once
 
 #include "Module.h"
+#include "DecryptEngine.h"
+#include "Extensions.h"
+#include "Metrics.h"
+#include "OutputPool.h"
+#include "PSSH.h"
 
 #include <cdm.h>
 #include <cdmi.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
 namespace CDMi
 {
-class MediaKeySession : public IMediaKeySession
+class MediaKeySession : public IMediaKeySession, public IMediaKeySessionDecrypt, public IMediaKeySessionOutput
 {
 public:
     MediaKeySession(widevine::Cdm*, int32_t);
+    // Adopts a CDM session that was created upfront, see the WideVine session pool.
+    MediaKeySession(widevine::Cdm*, widevine::Cdm::SessionType, const std::string&);
     virtual ~MediaKeySession(void);
 
+    static widevine::Cdm::SessionType sessionType(int32_t licenseType);
+    static bool createSession(widevine::Cdm*, widevine::Cdm::SessionType, std::string& sessionId);
+    static void closeSession(widevine::Cdm*, const std::string& sessionId);
+
     virtual void Run(
         const IMediaKeySessionCallback *f_piMediaKeySessionCallback);
 
+    // Starts the license request before an application is attached. The
+    // license request message is kept and handed to the application in Run,
+    // unless a license was loaded through Update in the meantime.
+    bool prefetch();
+    // The license request message kept by prefetch, if it is still pending.
+    bool pendingMessage(std::string& message);
+    bool attached() const { return ((m_piCallback.load() != nullptr) && (m_detaching.load() == 0)); }
+    // Stops the application callbacks. They are only made under
+    // m_callbackLock, so once this returns none is running on another
+    // thread and none follows: the application may delete its callback
+    // object. Decrypts are not held up by a running callback. While it
+    // waits for the lock, the queued events are already dropped.
+    void detach();
+    // Before the session is deleted: cancels the threads in WaitForKey and
+    // waits for them to leave (later waits fail right away), and it no
+    // longer lends its keys.
+    void retire();
+    bool retired() const { return (m_retired.load()); }
+
+    widevine::Cdm::SessionType licenseType() const { return (m_licenseType); }
+
+    // Decrypts with the keys of another session that already holds them
+    // (e.g. audio and video with the same key id, or a rejoin after a
+    // seek) instead of requesting a license of its own. Call before Run.
+    // Once the donor is retired or its keys are no longer usable, the next
+    // key status change has the session request a license after all.
+    void share(const std::shared_ptr<MediaKeySession>& donor, const PSSH::KeyIds& keyIds);
+    bool shared() const { return (m_shared.load()); }
+    // The keys this session holds itself and that are usable.
+    void usableKeyIds(PSSH::KeyIds& keyIds);
+    bool hasUsableKeys(const PSSH::KeyIds& keyIds);
+
     void* RunThread(int i);
 
     virtual CDMi_RESULT Load();
@@ -57,6 +105,12 @@ public:
         const uint8_t *f_pbCDMData,
         uint32_t f_cbCDMData);
 
+    // With initWithLast15 set the data is the next chunk of the sample the
+    // previous call for the same key id started, the IV is ignored and the
+    // CTR counter (also within a block) or CBC chain carries on. This way a
+    // large sample can be decrypted while it still arrives. The scheme and
+    // pattern must be those the sample started with. CBC chunks, except the
+    // last, must hold whole blocks, patterned chunks whole pattern cycles.
     virtual CDMi_RESULT Decrypt(
         const uint8_t *f_pbSessionKey,
         uint32_t f_cbSessionKey,
@@ -72,6 +126,39 @@ public:
         const uint8_t* keyId,
         bool initWithLast15);
 
+    // IMediaKeySessionDecrypt: the protected runs are handed to the CDM in
+    // as few calls as the scheme allows, with the IV state carried across.
+    virtual CDMi_RESULT DecryptSubSamples(
+        const EncryptionScheme encryptionScheme,
+        const EncryptionPattern& pattern,
+        const uint8_t *f_pbIV,
+        uint32_t f_cbIV,
+        uint8_t *f_pbData,
+        uint32_t f_cbData,
+        const SubSample* subSamples,
+        uint32_t subSampleCount,
+        const uint8_t keyIdLength,
+        const uint8_t* keyId);
+
+    // IMediaKeySessionDecrypt
+    virtual CDMi_RESULT DecryptSamples(
+        const EncryptionScheme encryptionScheme,
+        const EncryptionPattern& pattern,
+        const Sample* samples,
+        uint32_t sampleCount,
+        const uint8_t keyIdLength,
+        const uint8_t* keyId);
+
+    // IMediaKeySessionOutput
+    virtual CDMi_RESULT RegisterOutputPool(uint8_t* buffer, const uint32_t slotSize, const uint8_t slotCount);
+    virtual CDMi_RESULT UnregisterOutputPool();
+
+    // IMediaKeySessionDecrypt: woken by every key status change.
+    virtual CDMi_RESULT WaitForKey(
+        const uint8_t keyIdLength,
+        const uint8_t* keyId,
+        const uint32_t waitTime);
+    virtual void CancelWaitForKey();
 
     virtual CDMi_RESULT ReleaseClearContent(
         const uint8_t *f_pbSessionKey,
@@ -88,8 +175,103 @@ public:
     void onDeferredComplete(widevine::Cdm::Status);
     void onDirectIndividualizationRequest(const std::string&);
 
+    // Large samples are split over the engine's workers, if it has any.
+    void decryptEngine(DecryptEngine* engine) { m_engine = engine; }
+
+    // The CDM signalled a key status change, the cached table is refreshed
+    // lazily by the next user.
+    void invalidateKeyStatuses();
+
+    const Metrics::Session& metrics() const { return m_metrics; }
+    Metrics::Session& metrics() { return m_metrics; }
+
+private:
+    // Widevine key ids are 16 bytes, longer ids are never cached.
+    static constexpr uint8_t KeyIdSize = 16;
+
+    struct KeyStatusEntry {
+        uint8_t keyId[KeyIdSize];
+        uint8_t keyIdLength;
+        widevine::Cdm::KeyStatus status;
+    };
+    typedef std::vector<KeyStatusEntry> KeyStatusTable;
+
+    // Where the next chunk of a sample continues, see Decrypt. One per key
+    // id, so the samples of interleaved tracks (audio and video) can be
+    // fed in chunks at the same time.
+    static constexpr uint8_t MaxStreams = 4;
+
+    struct Stream {
+        uint8_t keyId[KeyIdSize];
+        uint8_t keyIdLength;
+        EncryptionScheme encryptionScheme;
+        EncryptionPattern pattern;
+        uint8_t iv[16];
+        uint8_t offset; // into the current counter block (CTR)
+        bool valid;
+        uint32_t started; // the least recently started one is reused
+    };
+
+    // Monotonic scratch memory for the decrypt paths. Allocations bump a
+    // pointer and are all released by the Reset at the start of the next
+    // call. A call that does not fit gets extra blocks, the next Reset
+    // folds them into one larger block, so the steady state never touches
+    // the heap. Only for trivially destructible data.
+    class Arena {
+    public:
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        Arena();
+        ~Arena() = default;
+
+    public:
+        void Reset();
+        uint8_t* Allocate(const uint32_t size);
+
+        template <typename TYPE>
+        TYPE* Allocate(const uint32_t count) {
+            return (reinterpret_cast<TYPE*>(Allocate(static_cast<uint32_t>(sizeof(TYPE) * count))));
+        }
+
+    private:
+        std::unique_ptr<uint8_t[]> _block;
+        uint32_t _size;
+        uint32_t _used;
+        uint32_t _spilled;
+        std::vector<std::unique_ptr<uint8_t[]>> _spills;
+    };
+
 private:
     void onKeyStatusError(widevine::Cdm::Status status);
+    void generateRequest();
+    void checkDonor();
+    bool refreshKeyStatuses();
+    const KeyStatusEntry* findKeyStatus(const uint8_t keyIdLength, const uint8_t* keyId) const;
+    const KeyStatusEntry* usableKey(const uint8_t keyIdLength, const uint8_t* keyId);
+    Stream* findStream(const uint8_t keyIdLength, const uint8_t* keyId, const bool start);
+    bool continueStream(
+        Stream& stream,
+        const uint8_t* data,
+        const uint32_t length);
+    bool keyUsable(const uint8_t keyIdLength, const uint8_t* keyId);
+    bool sharedKey(const uint8_t keyIdLength, const uint8_t* keyId, KeyStatusEntry& key);
+    bool decryptRange(
+        const KeyStatusEntry& key,
+        const EncryptionScheme encryptionScheme,
+        const EncryptionPattern& pattern,
+        const uint8_t iv[],
+        const uint8_t* input,
+        uint8_t* output,
+        uint32_t length);
+    bool decryptLarge(
+        const KeyStatusEntry& key,
+        const EncryptionScheme encryptionScheme,
+        const EncryptionPattern& pattern,
+        const uint8_t iv[],
+        const uint8_t* input,
+        uint8_t* output,
+        uint32_t length);
 
 private:
     widevine::Cdm *m_cdm;
@@ -98,8 +280,42 @@ private:
     widevine::Cdm::InitDataType m_initDataType;
     widevine::Cdm::SessionType m_licenseType;
     std::string m_sessionId;
-    IMediaKeySessionCallback *m_piCallback;
-    uint8_t m_IV[16];
+    // Set under m_callbackLock and m_lock, used under m_callbackLock, read
+    // without it to route the CDM events.
+    std::atomic<IMediaKeySessionCallback*> m_piCallback;
+    std::atomic<uint32_t> m_detaching;
+    Thunder::Core::CriticalSection m_callbackLock;
+    bool m_requested;
+    std::string m_pendingMessage;
+    std::string m_pendingUrl;
+    std::string m_message;
+    std::string m_response;
+    std::weak_ptr<MediaKeySession> m_donor;
+    PSSH::KeyIds m_sharedKeyIds;
+    std::atomic<bool> m_shared;
+    KeyStatusEntry m_sharedKey;
+    Stream m_streams[MaxStreams];
+    uint32_t m_streamsStarted;
+    Thunder::Core::CriticalSection m_lock;
+    KeyStatusTable m_keyStatuses;
+    // What the application was told, and the statuses being reported to
+    // it, both only used under m_callbackLock.
+    KeyStatusTable m_reportedKeyStatuses;
+    KeyStatusTable m_keyStatusReport;
+    std::atomic<bool> m_keyStatusesValid;
+    Arena m_arena;
+    DecryptEngine* m_engine;
+    // Decrypt writes into a slot of it, if one is free and large enough,
+    // instead of in place.
+    OutputPool m_outputPool;
+    Metrics::Session m_metrics;
+    std::mutex m_keyWaitLock;
+    std::condition_variable m_keyWait;
+    uint32_t m_keyGeneration;
+    uint32_t m_keyWaitCancel;
+    uint32_t m_keyWaiters;
+    bool m_keyWaitClosed;
+    std::atomic<bool> m_retired;
 };
 
 }  // namespace CDMi
@@ -17,13 +17,20 @@
 
 #include "Module.h"
 
+#include "EventDispatcher.h"
 #include "MediaSession.h"
 #include "HostImplementation.h"
 
 #include <assert.h>
+#include <condition_variable>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <string.h>
 #include <sys/utsname.h>
+#include <unordered_map>
 
 #include <core/core.h>
 #include <plugins/Types.h>
@@ -31,15 +38,147 @@
 using namespace Thunder;
 
 namespace CDMi {
-class WideVine : public IMediaKeys, public widevine::Cdm::IEventListener
+class WideVine : public IMediaKeys, public IMediaKeysStatistics, public IMediaKeysPrefetch, public widevine::Cdm::IEventListener
 {
 private:
     WideVine (const WideVine&) = delete;
     WideVine& operator= (const WideVine&) = delete;
 
     static constexpr char _certificateFilename[] = {"cert.bin"};
+    static constexpr uint32_t _eventQueueSize = 256;
+    static constexpr uint32_t _keyStatusWindow = 10; // ms
+
+    // Sessions are reference counted: the registry holds one reference, a
+    // CDM event being dispatched to the session holds another, so a session
+    // is only deleted once DestroyMediaKeySession removed it and no callback
+    // is running on it anymore.
+    typedef std::shared_ptr<MediaKeySession> SessionReference;
+    typedef std::unordered_map<std::string, SessionReference> SessionMap;
+
+    // The registry is read for every CDM event but only changes when a
+    // session is created or destroyed. Readers take an immutable snapshot
+    // with std::atomic_load, writers copy, modify and publish a new table
+    // (RCU style), serialized by _adminLock. The atomic shared_ptr access is
+    // not lock-free (libstdc++ guards it with a pool of mutexes), but it
+    // only covers the pointer copy, never the lookup or a callback, and
+    // readers do not contend on _adminLock. An old table, and the sessions
+    // only it still references, lives on until the last reader drops it.
+    typedef std::shared_ptr<const SessionMap> SessionTable;
+
+    enum state : uint8_t {
+        STARTING,
+        READY,
+        FAILED
+    };
+
+    // CDM sessions created ahead of time, per session type, so that
+    // CreateMediaKeySession does not pay for widevine::Cdm::createSession
+    // on the channel zapping path. Refilled in the background.
+    class SessionPool {
+    private:
+        static constexpr uint8_t Types = 2; // kTemporary, kPersistentLicense
+
+    public:
+        SessionPool(const SessionPool&) = delete;
+        SessionPool& operator=(const SessionPool&) = delete;
+
+        SessionPool()
+            : _lock()
+            , _size(0)
+            , _sessions()
+        {
+        }
+        ~SessionPool()
+        {
+            ASSERT(_sessions[0].empty() && _sessions[1].empty());
+        }
+
+    public:
+        void Size(const uint8_t size)
+        {
+            _size = size;
+        }
+        bool Acquire(const widevine::Cdm::SessionType type, std::string& sessionId)
+        {
+            bool result = false;
+            std::list<std::string>* pool = Pool(type);
+
+            if (pool != nullptr) {
+                _lock.Lock();
+                if (pool->empty() == false) {
+                    sessionId = std::move(pool->front());
+                    pool->pop_front();
+                    result = true;
+                }
+                _lock.Unlock();
+            }
+            return (result);
+        }
+        // Tops up all pools, sessions are created outside of the lock.
+        void Fill(widevine::Cdm* cdm)
+        {
+            static const widevine::Cdm::SessionType types[Types] = { widevine::Cdm::kTemporary, widevine::Cdm::kPersistentLicense };
+
+            for (const widevine::Cdm::SessionType type : types) {
+                std::list<std::string>& pool(*Pool(type));
+
+                _lock.Lock();
+                uint8_t missing = (pool.size() < _size ? _size - static_cast<uint8_t>(pool.size()) : 0);
+                _lock.Unlock();
+
+                while (missing-- > 0) {
+                    std::string sessionId;
+
+                    if (MediaKeySession::createSession(cdm, type, sessionId) == false) {
+                        break;
+                    }
+
+                    _lock.Lock();
+                    pool.push_back(std::move(sessionId));
+                    _lock.Unlock();
+                }
+            }
+        }
+        void Drain(widevine::Cdm* cdm)
+        {
+            _lock.Lock();
+            for (std::list<std::string>& pool : _sessions) {
+                for (const std::string& sessionId : pool) {
+                    MediaKeySession::closeSession(cdm, sessionId);
+                }
+                pool.clear();
+            }
+            _lock.Unlock();
+        }
 
-    typedef std::map<std::string, MediaKeySession*> SessionMap;
+    private:
+        std::list<std::string>* Pool(const widevine::Cdm::SessionType type)
+        {
+            return (type == widevine::Cdm::kTemporary ? &_sessions[0] :
+                   (type == widevine::Cdm::kPersistentLicense ? &_sessions[1] : nullptr));
+        }
+
+    private:
+        Core::CriticalSection _lock;
+        uint8_t _size;
+        std::list<std::string> _sessions[Types];
+    };
+
+    // A session whose license request was started ahead of playback, see
+    // Prefetch. Handed out by CreateMediaKeySession for the same init data.
+    struct Prefetched {
+        widevine::Cdm::SessionType type;
+        std::string initDataType;
+        std::string initData;
+        SessionReference session;
+    };
+    typedef std::list<Prefetched> PrefetchList;
+
+    // Key id to the session that holds it usable, so a session for init
+    // data whose keys are already loaded can share them. The sessions are
+    // checked again before use, expired entries are pruned as it grows.
+    typedef std::unordered_map<std::string, std::weak_ptr<MediaKeySession>> KeyIndex;
+    static constexpr uint32_t _keyIndexPrune = 256;
 
     class Config : public Core::JSON::Container {
     public:
@@ -54,6 +193,11 @@ private:
             , Model()
             , Device()
             , StorageLocation()
+            , Clock()
+            , Metrics(false)
+            , SessionPool(1)
+            , Prefetch(4)
+            , DecryptThreads(0)
         {
             Add(_T("certificate"), &Certificate);
             Add(_T("keybox"), &Keybox);
@@ -62,6 +206,11 @@ private:
             Add(_T("model"), &Model);
             Add(_T("device"), &Device);
             Add(_T("storagelocation"), &StorageLocation);
+            Add(_T("clock"), &Clock);
+            Add(_T("metrics"), &Metrics);
+            Add(_T("sessionpool"), &SessionPool);
+            Add(_T("prefetch"), &Prefetch);
+            Add(_T("decryptthreads"), &DecryptThreads);
         }
         ~Config()
         {
@@ -75,6 +224,11 @@ private:
         Core::JSON::String Model;
         Core::JSON::String Device;
         Core::JSON::String StorageLocation;
+        Core::JSON::String Clock;
+        Core::JSON::Boolean Metrics;
+        Core::JSON::DecUInt8 SessionPool;
+        Core::JSON::DecUInt8 Prefetch;
+        Core::JSON::DecUInt8 DecryptThreads;
     };
 
 public:
@@ -82,19 +236,46 @@ public:
         : _adminLock()
         , _cdm(nullptr)
         , _host()
-        , _sessions() {
+        , _engine()
+        , _sessions(std::make_shared<const SessionMap>())
+        , _retired()
+        , _pool()
+        , _prefetchLock()
+        , _prefetched()
+        , _prefetchSize(0)
+        , _keyIndexLock()
+        , _keyIndex()
+        , _readyLock()
+        , _readyChanged()
+        , _state(STARTING)
+        , _activated(0)
+        , _firstSession(true)
+        , _dispatcher(_eventQueueSize, _keyStatusWindow) {
     }
     virtual ~WideVine() {
-        _adminLock.Lock();
+        // No application callbacks from here on.
+        _dispatcher.Close();
 
-        SessionMap::iterator index (_sessions.begin());
+        {
+            // Start may never have run.
+            std::unique_lock<std::mutex> lock(_readyLock);
+            if (_state == STARTING) {
+                _state = FAILED;
+                _readyChanged.notify_all();
+            }
+        }
 
-        while  (index != _sessions.end()) {
-            delete index->second;
-            index++;
+        if (_cdm != nullptr) {
+            for (Prefetched& entry : _prefetched) {
+                entry.session->Close();
+            }
+            _pool.Drain(_cdm);
         }
+        _prefetched.clear();
+
+        _adminLock.Lock();
 
-        _sessions.clear();
+        std::atomic_store(&_sessions, std::make_shared<const SessionMap>());
 
         _adminLock.Unlock();
 
@@ -105,6 +286,8 @@ public:
 
     void Initialize(const Thunder::PluginHost::IShell* shell, const std::string& configline)
     {
+        _activated = SinceBoot();
+
         widevine::Cdm::ClientInfo client_info;
 
         Config config;
@@ -153,6 +336,8 @@ public:
             Core::SystemInfo::SetEnvironment("WIDEVINE_STORAGE_PATH", config.StorageLocation.Value().c_str());
         }
 
+        string certificate;
+
         if ((config.Certificate.IsSet() == true) && (config.Certificate.Value().empty() == false)) {
 
             ASSERT(shell != nullptr);
@@ -173,22 +358,37 @@ public:
                 subsystem->Release();
             }
 
-            TRACE(Trace::Information, (_T("loading certificate is set to: \'%s\'\n"), string(storage + config.Certificate.Value()).c_str()));
+            certificate = storage + config.Certificate.Value();
+        }
 
-            Core::DataElementFile dataBuffer(storage + config.Certificate.Value(), Core::File::USER_READ);
+        Metrics::Enable(config.Metrics.Value());
 
-            if(dataBuffer.IsValid() == false) {
-                TRACE(Trace::Warning, (_T("Failed to open %s"), config.Certificate.Value().c_str()));
-            } else {
-                _host.PreloadFile(_certificateFilename,  std::string(reinterpret_cast<const char*>(dataBuffer.Buffer()), dataBuffer.Size()));
+        if (config.Clock.IsSet() == true) {
+            // "forward" (default), "monotonic" or "wallclock", see HostImplementation::ClockPolicy.
+            if (config.Clock.Value() == _T("wallclock")) {
+                _host.Clock(HostImplementation::ClockPolicy::WALLCLOCK);
+            } else if (config.Clock.Value() == _T("monotonic")) {
+                _host.Clock(HostImplementation::ClockPolicy::MONOTONIC);
+            } else if (config.Clock.Value() != _T("forward")) {
+                TRACE(Trace::Warning, (_T("Unknown clock policy %s, using forward"), config.Clock.Value().c_str()));
             }
         }
 
-        if (widevine::Cdm::kSuccess == widevine::Cdm::initialize(
-                widevine::Cdm::kNoSecureOutput, client_info, &_host,
-                &_host, &_host, static_cast<widevine::Cdm::LogLevel>(0))) {
-            _cdm = widevine::Cdm::create(this, &_host, false);
-        }
+        _prefetchSize = config.Prefetch.Value();
+
+        // Extra threads that share the decrypt of large samples with the
+        // calling thread, 0 keeps the decrypt on the calling thread only.
+        _engine.Start(config.DecryptThreads.Value());
+
+        // Loading the certificate and the storage and bringing up the CDM
+        // take a while, do not keep the plugin activation waiting for it.
+        // Whoever needs the CDM waits for it to be ready, see Ready().
+        const string storageLocation (config.StorageLocation.IsSet() == true ? config.StorageLocation.Value() : string());
+        const uint8_t poolSize = config.SessionPool.Value();
+
+        _dispatcher.Submit([this, client_info, certificate, storageLocation, poolSize]() {
+            Start(client_info, certificate, storageLocation, poolSize);
+        });
     }
 
     virtual CDMi_RESULT CreateMediaKeySession(
@@ -204,7 +404,33 @@ public:
         CDMi_RESULT dr = CDMi_S_FALSE;
         *f_ppiMediaKeySession = nullptr;
 
-        MediaKeySession* mediaKeySession = new MediaKeySession(_cdm, licenseType);
+        if (Ready() == false) {
+            return (dr);
+        }
+
+        if (_firstSession.exchange(false) == true) {
+            TRACE(Trace::Information, (_T("First session %u ms after activation, %u ms after boot"),
+                static_cast<uint32_t>(SinceBoot() - _activated), static_cast<uint32_t>(SinceBoot())));
+        }
+
+        const widevine::Cdm::SessionType sessionType (MediaKeySession::sessionType(licenseType));
+
+        SessionReference prefetched (TakePrefetched(sessionType, f_pwszInitDataType, f_pbInitData, f_cbInitData));
+
+        if (prefetched != nullptr) {
+            // Already registered, the license request is on its way (or done).
+            *f_ppiMediaKeySession = prefetched.get();
+            return (CDMi_SUCCESS);
+        }
+
+        PSSH::KeyIds keyIds;
+        SessionReference donor (FindDonor(sessionType, f_pwszInitDataType, f_pbInitData, f_cbInitData, keyIds));
+
+        MediaKeySession* mediaKeySession = NewSession(licenseType);
+
+        if (donor != nullptr) {
+            mediaKeySession->share(donor, keyIds);
+        }
 
         dr = mediaKeySession->Init(licenseType,
             f_pwszInitDataType,
@@ -218,8 +444,7 @@ public:
             delete mediaKeySession;
         }
         else {
-            std::string sessionId (mediaKeySession->GetSessionId());
-            _sessions.insert(std::pair<std::string, MediaKeySession*>(sessionId, mediaKeySession));
+            Register(mediaKeySession);
             *f_ppiMediaKeySession = mediaKeySession;
         }
 
@@ -233,7 +458,7 @@ public:
         CDMi_RESULT dr = CDMi_S_FALSE;
 
         std::string serverCertificate(reinterpret_cast<const char*>(f_pbServerCertificate), f_cbServerCertificate);
-        if (widevine::Cdm::kSuccess == _cdm->setServiceCertificate(widevine::Cdm::kAllServices, serverCertificate)) {
+        if ((Ready() == true) && (widevine::Cdm::kSuccess == _cdm->setServiceCertificate(widevine::Cdm::kAllServices, serverCertificate))) {
             dr = CDMi_SUCCESS;
         }
         return dr;
@@ -242,82 +467,523 @@ public:
     virtual CDMi_RESULT DestroyMediaKeySession(
         IMediaKeySession *f_piMediaKeySession) {
 
-        std::string sessionId (f_piMediaKeySession->GetSessionId());
+        // Waits for a callback that is being delivered to the session, the
+        // application may delete its callback object as soon as this returns.
+        static_cast<MediaKeySession*>(f_piMediaKeySession)->detach();
+        // Nor may a thread still be in WaitForKey when it is deleted.
+        static_cast<MediaKeySession*>(f_piMediaKeySession)->retire();
+        _dispatcher.Forget(static_cast<MediaKeySession*>(f_piMediaKeySession));
+        // Those that shared its keys need a license of their own now.
+        CheckSharers();
+
+        if (Unregister(f_piMediaKeySession) == false) {
+            // Never made it into the registry, so we are the only owner.
+            delete f_piMediaKeySession;
+        }
 
-        _adminLock.Lock();
+        return CDMi_SUCCESS;
+    }
+
+    // IMediaKeysPrefetch implementation
+    uint32_t Prefetch(
+        int32_t licenseType,
+        const char* initDataType,
+        const std::vector<std::string>& initData) override
+    {
+        uint32_t result = 0;
+        const widevine::Cdm::SessionType sessionType (MediaKeySession::sessionType(licenseType));
+
+        if ((_prefetchSize == 0) || (Ready() == false)) {
+            return (result);
+        }
+
+        for (const std::string& entry : initData) {
+            if (entry.empty() == true) {
+                continue;
+            }
+
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(entry.data());
+            const uint32_t length = static_cast<uint32_t>(entry.length());
+
+            if (FindPrefetched(sessionType, initDataType, data, length) != nullptr) {
+                result++;
+                continue;
+            }
+
+            MediaKeySession* mediaKeySession = NewSession(licenseType);
+            mediaKeySession->Init(licenseType, initDataType, data, length, nullptr, 0);
+
+            Register(mediaKeySession);
+            SessionReference session (Find(mediaKeySession->GetSessionId()));
+
+            if (session.get() != mediaKeySession) {
+                delete mediaKeySession;
+            } else if (session->prefetch() == false) {
+                session->Close();
+                Unregister(session.get());
+            } else {
+                Prefetched prefetched;
+                prefetched.type = sessionType;
+                prefetched.initDataType = (initDataType != nullptr ? initDataType : "");
+                prefetched.initData = entry;
+                prefetched.session = std::move(session);
+                AddPrefetched(std::move(prefetched));
+                result++;
+            }
+        }
+
+        return (result);
+    }
+
+    CDMi_RESULT PrefetchChallenge(
+        int32_t licenseType,
+        const char* initDataType,
+        const uint8_t* initData,
+        uint32_t initDataLength,
+        std::string& challenge) override
+    {
+        SessionReference session (FindPrefetched(MediaKeySession::sessionType(licenseType), initDataType, initData, initDataLength));
+
+        return (((session != nullptr) && (session->pendingMessage(challenge) == true)) ? CDMi_SUCCESS : CDMi_S_FALSE);
+    }
 
-        SessionMap::iterator index (_sessions.find(sessionId));
+    CDMi_RESULT PrefetchResponse(
+        int32_t licenseType,
+        const char* initDataType,
+        const uint8_t* initData,
+        uint32_t initDataLength,
+        const uint8_t* response,
+        uint32_t responseLength) override
+    {
+        SessionReference session (FindPrefetched(MediaKeySession::sessionType(licenseType), initDataType, initData, initDataLength));
 
-        if (index != _sessions.end()) {
-            _sessions.erase(index);
+        if (session != nullptr) {
+            session->Update(response, responseLength);
         }
+        return (session != nullptr ? CDMi_SUCCESS : CDMi_S_FALSE);
+    }
+
+    // IMediaKeysStatistics implementation
+    void Statistics(std::string& result) const override
+    {
+        Metrics::Session total;
+
+        result = "{\"enabled\":";
+        result += (Metrics::IsEnabled() == true ? "true" : "false");
+        result += ",\"sessions\":{";
 
+        // Together, so a session retired in between is counted once.
+        _adminLock.Lock();
+        SessionTable sessions (std::atomic_load(&_sessions));
+        total.Merge(_retired);
         _adminLock.Unlock();
 
-        delete f_piMediaKeySession;
+        for (SessionMap::const_iterator index = sessions->begin(); index != sessions->end(); index++) {
+            total.Merge(index->second->metrics());
 
-        return CDMi_SUCCESS;
+            if (index != sessions->begin()) {
+                result += ',';
+            }
+            result += '"';
+            result += index->first;
+            result += "\":";
+            index->second->metrics().ToString(result);
+        }
+
+        result += "},\"total\":";
+        total.ToString(result);
+        result += '}';
     }
 
     virtual void onMessage(const std::string& session_id,
         widevine::Cdm::MessageType f_messageType,
         const std::string& f_message) {
 
-        _adminLock.Lock();
+        SessionReference session (Find(session_id));
 
-        SessionMap::iterator index (_sessions.find(session_id));
+        if (session != nullptr) {
+            if (session->attached() == false) {
+                // Prefetched, the session only keeps the message: no need to
+                // go through the dispatcher, PrefetchChallenge can pick it up
+                // as soon as the request was generated.
+                session->onMessage(f_messageType, f_message);
+            } else {
+                _dispatcher.Message(session, f_messageType, f_message);
+            }
+        }
+    }
 
-        if (index != _sessions.end()) index->second->onMessage(f_messageType, f_message);
+    virtual void onKeyStatusesChange(const std::string& session_id, bool has_new_usable_key) {
 
-        _adminLock.Unlock();
-    }
+        SessionReference session (Find(session_id));
 
-    virtual void onKeyStatusesChange(const std::string& /*session_id*/, bool /*has_new_usable_key*/) {
+        if (session != nullptr) {
+            session->invalidateKeyStatuses();
+            _dispatcher.KeyStatusChange(session, has_new_usable_key);
+
+            if ((has_new_usable_key == true) && (session->shared() == false)) {
+                std::weak_ptr<MediaKeySession> owner (session);
+                _dispatcher.Submit([this, owner]() { Index(owner); });
+            } else if (session->shared() == false) {
+                // Keys may have expired or been released.
+                CheckSharers();
+            }
+        }
     }
 
     virtual void onRemoveComplete(const std::string& session_id) {
 
-        _adminLock.Lock();
-
-        SessionMap::iterator index (_sessions.find(session_id));
-
-        if (index != _sessions.end()) index->second->onRemoveComplete();
+        SessionReference session (Find(session_id));
 
-        _adminLock.Unlock();
+        if (session != nullptr) _dispatcher.RemoveComplete(session);
     }
 
     // Called when a deferred action has completed.
     virtual void onDeferredComplete(const std::string& session_id, widevine::Cdm::Status result) {
 
+        SessionReference session (Find(session_id));
+
+        if (session != nullptr) _dispatcher.DeferredComplete(session, result);
+    }
+
+    // Called when the CDM requires a new device certificate
+    virtual void onDirectIndividualizationRequest(const std::string& session_id, const std::string& request) {
+
+        SessionReference session (Find(session_id));
+
+        if (session != nullptr) _dispatcher.IndividualizationRequest(session, request);
+    }
+
+private:
+    // Milliseconds since boot, suspend included.
+    static uint64_t SinceBoot()
+    {
+        struct timespec now;
+        ::clock_gettime(CLOCK_BOOTTIME, &now);
+        return ((static_cast<uint64_t>(now.tv_sec) * 1000) + (now.tv_nsec / 1000000));
+    }
+
+    // Runs on the dispatcher thread, the second half of Initialize.
+    void Start(const widevine::Cdm::ClientInfo& client_info, const string& certificate, const string& storageLocation, const uint8_t poolSize)
+    {
+        if (certificate.empty() == false) {
+            TRACE(Trace::Information, (_T("loading certificate is set to: \'%s\'\n"), certificate.c_str()));
+
+            if (_host.LoadFile(_certificateFilename, certificate) == false) {
+                TRACE(Trace::Warning, (_T("Failed to open %s"), certificate.c_str()));
+            }
+        }
+
+        if (storageLocation.empty() == false) {
+            // Persistent licenses, usage records and the provisioned device
+            // certificate survive a restart.
+            if (_host.Open(storageLocation) == false) {
+                TRACE(Trace::Warning, (_T("Failed to open storage %s, falling back to memory"), storageLocation.c_str()));
+            }
+        }
+
+        widevine::Cdm* cdm = nullptr;
+
+        if (widevine::Cdm::kSuccess == widevine::Cdm::initialize(
+                widevine::Cdm::kNoSecureOutput, client_info, &_host,
+                &_host, &_host, static_cast<widevine::Cdm::LogLevel>(0))) {
+            cdm = widevine::Cdm::create(this, &_host, false);
+        }
+
+        std::unique_lock<std::mutex> lock(_readyLock);
+        _cdm = cdm;
+        _state = (cdm != nullptr ? READY : FAILED);
+        _readyChanged.notify_all();
+        lock.unlock();
+
+        TRACE(Trace::Information, (_T("CDM %s %u ms after activation, %u ms after boot"), (cdm != nullptr ? _T("ready") : _T("failed")),
+            static_cast<uint32_t>(SinceBoot() - _activated), static_cast<uint32_t>(SinceBoot())));
+
+        if ((cdm != nullptr) && (poolSize > 0)) {
+            _pool.Size(poolSize);
+            _pool.Fill(cdm);
+        }
+    }
+
+    // Waits for the CDM to come up, false if it did not.
+    bool Ready()
+    {
+        std::unique_lock<std::mutex> lock(_readyLock);
+        _readyChanged.wait(lock, [this]() { return (_state != STARTING); });
+        return (_state == READY);
+    }
+
+    MediaKeySession* NewSession(const int32_t licenseType)
+    {
+        std::string sessionId;
+        const widevine::Cdm::SessionType sessionType (MediaKeySession::sessionType(licenseType));
+
+        MediaKeySession* result;
+
+        if (_pool.Acquire(sessionType, sessionId) == true) {
+            RefillPool();
+            result = new MediaKeySession(_cdm, sessionType, sessionId);
+        } else {
+            result = new MediaKeySession(_cdm, licenseType);
+        }
+        result->decryptEngine(&_engine);
+        return (result);
+    }
+
+    static bool Matches(
+        const Prefetched& entry,
+        const widevine::Cdm::SessionType type,
+        const char* initDataType,
+        const uint8_t* initData,
+        const uint32_t initDataLength)
+    {
+        return ((entry.type == type) &&
+                (entry.initData.length() == initDataLength) &&
+                (entry.initDataType == (initDataType != nullptr ? initDataType : "")) &&
+                (::memcmp(entry.initData.data(), initData, initDataLength) == 0));
+    }
+
+    SessionReference FindPrefetched(const widevine::Cdm::SessionType type, const char* initDataType, const uint8_t* initData, const uint32_t initDataLength)
+    {
+        SessionReference result;
+
+        _prefetchLock.Lock();
+
+        for (PrefetchList::iterator index = _prefetched.begin(); index != _prefetched.end(); index++) {
+            if (Matches(*index, type, initDataType, initData, initDataLength) == true) {
+                // Most recently used first.
+                _prefetched.splice(_prefetched.begin(), _prefetched, index);
+                result = _prefetched.front().session;
+                break;
+            }
+        }
+
+        _prefetchLock.Unlock();
+
+        return (result);
+    }
+
+    SessionReference TakePrefetched(const widevine::Cdm::SessionType type, const char* initDataType, const uint8_t* initData, const uint32_t initDataLength)
+    {
+        SessionReference result;
+
+        if ((initData != nullptr) && (initDataLength > 0)) {
+            _prefetchLock.Lock();
+
+            for (PrefetchList::iterator index = _prefetched.begin(); index != _prefetched.end(); index++) {
+                if (Matches(*index, type, initDataType, initData, initDataLength) == true) {
+                    result = std::move(index->session);
+                    _prefetched.erase(index);
+                    break;
+                }
+            }
+
+            _prefetchLock.Unlock();
+        }
+
+        return (result);
+    }
+
+    void AddPrefetched(Prefetched&& entry)
+    {
+        PrefetchList evicted;
+
+        _prefetchLock.Lock();
+
+        _prefetched.push_front(std::move(entry));
+
+        while (_prefetched.size() > _prefetchSize) {
+            evicted.splice(evicted.end(), _prefetched, std::prev(_prefetched.end()));
+        }
+
+        _prefetchLock.Unlock();
+
+        for (Prefetched& stale : evicted) {
+            stale.session->Close();
+            Unregister(stale.session.get());
+        }
+    }
+
+    static std::string IndexKey(const PSSH::KeyId& keyId)
+    {
+        return (std::string(reinterpret_cast<const char*>(keyId.bytes), sizeof(keyId.bytes)));
+    }
+
+    void Index(const std::weak_ptr<MediaKeySession>& owner)
+    {
+        SessionReference session (owner.lock());
+
+        if (session != nullptr) {
+            PSSH::KeyIds keyIds;
+            session->usableKeyIds(keyIds);
+
+            _keyIndexLock.Lock();
+
+            if (_keyIndex.size() >= _keyIndexPrune) {
+                for (KeyIndex::iterator index = _keyIndex.begin(); index != _keyIndex.end();) {
+                    index = (index->second.expired() == true ? _keyIndex.erase(index) : std::next(index));
+                }
+            }
+
+            for (const PSSH::KeyId& keyId : keyIds) {
+                _keyIndex[IndexKey(keyId)] = owner;
+            }
+
+            _keyIndexLock.Unlock();
+        }
+    }
+
+    // Has every session that shares keys check its donor, on the dispatch
+    // thread. Posting only, the CDM may call this with plugin locks held.
+    void CheckSharers()
+    {
+        SessionTable sessions (std::atomic_load(&_sessions));
+
+        for (SessionMap::const_iterator index = sessions->begin(); index != sessions->end(); index++) {
+            if (index->second->shared() == true) {
+                _dispatcher.KeyStatusChange(index->second, true);
+            }
+        }
+    }
+
+    // The live session of the same license type that holds all keys of the
+    // init data usable, if any.
+    SessionReference FindDonor(const widevine::Cdm::SessionType type, const char* initDataType, const uint8_t* initData, const uint32_t initDataLength, PSSH::KeyIds& keyIds)
+    {
+        SessionReference result;
+
+        if ((initDataType == nullptr) || (initData == nullptr)) {
+            keyIds.clear();
+        } else if (::strcmp(initDataType, "webm") == 0) {
+            // WebM init data is the key id itself.
+            keyIds.clear();
+            if (initDataLength == sizeof(PSSH::KeyId::bytes)) {
+                keyIds.emplace_back();
+                ::memcpy(keyIds.back().bytes, initData, initDataLength);
+            }
+        } else if ((::strcmp(initDataType, "cenc") != 0) || (PSSH::Parse(initData, initDataLength, keyIds) == false)) {
+            keyIds.clear();
+        }
+
+        if (keyIds.empty() == false) {
+            _keyIndexLock.Lock();
+
+            for (const PSSH::KeyId& keyId : keyIds) {
+                KeyIndex::const_iterator index (_keyIndex.find(IndexKey(keyId)));
+                SessionReference session (index != _keyIndex.end() ? index->second.lock() : SessionReference());
+
+                if ((session == nullptr) || ((result != nullptr) && (result != session))) {
+                    result.reset();
+                    break;
+                }
+                result = std::move(session);
+            }
+
+            _keyIndexLock.Unlock();
+
+            if ((result != nullptr) && ((result->licenseType() != type) || (result->retired() == true) || (result->hasUsableKeys(keyIds) == false))) {
+                result.reset();
+            }
+        }
+
+        return (result);
+    }
+
+    void RefillPool()
+    {
+        widevine::Cdm* cdm = _cdm;
+        _dispatcher.Submit([this, cdm]() { _pool.Fill(cdm); });
+    }
+
+    SessionReference Find(const std::string& sessionId) const
+    {
+        SessionReference result;
+        SessionTable sessions (std::atomic_load(&_sessions));
+
+        SessionMap::const_iterator index (sessions->find(sessionId));
+
+        if (index != sessions->end()) {
+            result = index->second;
+        }
+        return (result);
+    }
+
+    void Register(MediaKeySession* mediaKeySession)
+    {
+        const std::string sessionId (mediaKeySession->GetSessionId());
+
         _adminLock.Lock();
 
-        SessionMap::iterator index (_sessions.find(session_id));
+        SessionTable current (std::atomic_load(&_sessions));
+
+        if (current->find(sessionId) != current->end()) {
+            // The caller keeps sole ownership, see DestroyMediaKeySession.
+            TRACE(Trace::Warning, (_T("Session id '%s' already in use"), sessionId.c_str()));
+        } else {
+            std::shared_ptr<SessionMap> sessions (std::make_shared<SessionMap>(*current));
 
-        if (index != _sessions.end()) index->second->onDeferredComplete(result);
+            // Whoever drops the last reference deletes the session, its
+            // metrics were folded into the totals by Unregister.
+            sessions->emplace(sessionId, SessionReference(mediaKeySession, [](MediaKeySession* entry) {
+                delete entry;
+            }));
+
+            std::atomic_store(&_sessions, SessionTable(sessions));
+        }
 
         _adminLock.Unlock();
     }
 
-    // Called when the CDM requires a new device certificate
-    virtual void onDirectIndividualizationRequest(const std::string& session_id, const std::string& request) {
+    bool Unregister(IMediaKeySession* mediaKeySession)
+    {
+        bool result = false;
 
         _adminLock.Lock();
 
-        SessionMap::iterator index (_sessions.find(session_id));
-
-        if (index != _sessions.end()) index->second->onDirectIndividualizationRequest(request);
+        SessionTable current (std::atomic_load(&_sessions));
+        SessionMap::const_iterator index (current->find(mediaKeySession->GetSessionId()));
+
+        if ((index != current->end()) && (index->second.get() == mediaKeySession)) {
+            std::shared_ptr<SessionMap> sessions (std::make_shared<SessionMap>(*current));
+            // Retired here and not by the last reference, which an event in
+            // flight may hold on to, so the totals are complete on return.
+            _retired.Merge(index->second->metrics());
+            sessions->erase(index->first);
+            std::atomic_store(&_sessions, SessionTable(sessions));
+            result = true;
+        }
 
         _adminLock.Unlock();
+
+        return (result);
     }
 
 private:
-    Thunder::Core::CriticalSection _adminLock;
+    mutable Thunder::Core::CriticalSection _adminLock;
     widevine::Cdm* _cdm;
     HostImplementation _host;
-    SessionMap _sessions;
+    DecryptEngine _engine;
+    SessionTable _sessions;
+    Metrics::Session _retired;
+    SessionPool _pool;
+    Core::CriticalSection _prefetchLock;
+    PrefetchList _prefetched;
+    uint8_t _prefetchSize;
+    Core::CriticalSection _keyIndexLock;
+    KeyIndex _keyIndex;
+    std::mutex _readyLock;
+    std::condition_variable _readyChanged;
+    state _state;
+    uint64_t _activated;
+    std::atomic<bool> _firstSession;
+    EventDispatcher _dispatcher;
 };
 
 constexpr char WideVine::_certificateFilename[];
+constexpr uint32_t WideVine::_eventQueueSize;
+constexpr uint32_t WideVine::_keyStatusWindow;
+constexpr uint8_t WideVine::SessionPool::Types;
+constexpr uint32_t WideVine::_keyIndexPrune;
 
 static SystemFactoryType<WideVine> g_instance({"video/webm", "video/mp4", "audio/webm", "audio/mp4"});
 
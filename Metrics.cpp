@@ -0,0 +1,176 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace CDMi {
+namespace Metrics {
+
+static std::atomic<bool> g_enabled(false);
+
+static const char* const g_phaseNames[PHASES] = {
+    "lockwait",
+    "keylookup",
+    "decrypt",
+    "update",
+    "load",
+    "message",
+    "dispatch"
+};
+
+static const char* const g_failureNames[FAILURES] = {
+    "typeerror",
+    "notsupported",
+    "invalidstate",
+    "quotaexceeded",
+    "needsdevicecertificate",
+    "sessionnotfound",
+    "decrypterror",
+    "nokey",
+    "unexpectederror",
+    "other"
+};
+
+void Enable(const bool enabled)
+{
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool IsEnabled()
+{
+    return (g_enabled.load(std::memory_order_relaxed));
+}
+
+Histogram::Histogram()
+    : _count(0)
+    , _sum(0)
+{
+    for (std::atomic<uint64_t>& bucket : _buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::Add(const uint64_t duration)
+{
+    uint8_t index = 0;
+    for (uint64_t value = duration; (value > 1) && (index < (Buckets - 1)); value >>= 1) {
+        index++;
+    }
+
+    _buckets[index].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(duration, std::memory_order_relaxed);
+}
+
+void Histogram::Merge(const Histogram& other)
+{
+    for (uint8_t index = 0; index < Buckets; index++) {
+        _buckets[index].fetch_add(other.Bucket(index), std::memory_order_relaxed);
+    }
+    _count.fetch_add(other.Count(), std::memory_order_relaxed);
+    _sum.fetch_add(other.Sum(), std::memory_order_relaxed);
+}
+
+Session::Session()
+    : _phases()
+    , _calls(0)
+    , _bytes(0)
+    , _noKey(0)
+{
+    for (std::atomic<uint64_t>& failure : _failures) {
+        failure.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Session::Merge(const Session& other)
+{
+    for (uint8_t phase = 0; phase < PHASES; phase++) {
+        _phases[phase].Merge(other._phases[phase]);
+    }
+    _calls.fetch_add(other._calls.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    _bytes.fetch_add(other._bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    _noKey.fetch_add(other._noKey.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    for (uint8_t failure = 0; failure < FAILURES; failure++) {
+        _failures[failure].fetch_add(other._failures[failure].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+// Appends the formatted text, however long it turns out.
+static void Append(std::string& result, const char* format, ...)
+{
+    char buffer[128];
+    va_list arguments;
+
+    va_start(arguments, format);
+    const int length = vsnprintf(buffer, sizeof(buffer), format, arguments);
+    va_end(arguments);
+
+    if (length >= static_cast<int>(sizeof(buffer))) {
+        const size_t offset = result.size();
+        result.resize(offset + length + 1);
+        va_start(arguments, format);
+        vsnprintf(&result[offset], length + 1, format, arguments);
+        va_end(arguments);
+        result.resize(offset + length);
+    } else if (length > 0) {
+        result.append(buffer, length);
+    }
+}
+
+void Session::ToString(std::string& result) const
+{
+    Append(result, "{\"calls\":%llu,\"bytes\":%llu,\"nokey\":%llu",
+        static_cast<unsigned long long>(_calls.load(std::memory_order_relaxed)),
+        static_cast<unsigned long long>(_bytes.load(std::memory_order_relaxed)),
+        static_cast<unsigned long long>(_noKey.load(std::memory_order_relaxed)));
+
+    result += ",\"failures\":{";
+    bool first = true;
+    for (uint8_t failure = 0; failure < FAILURES; failure++) {
+        const uint64_t count = _failures[failure].load(std::memory_order_relaxed);
+        if (count != 0) {
+            Append(result, "%s\"%s\":%llu", (first ? "" : ","), g_failureNames[failure],
+                static_cast<unsigned long long>(count));
+            first = false;
+        }
+    }
+    result += '}';
+
+    for (uint8_t phase = 0; phase < PHASES; phase++) {
+        const Histogram& histogram(_phases[phase]);
+
+        Append(result, ",\"%s\":{\"count\":%llu,\"sum\":%llu,\"buckets\":[",
+            g_phaseNames[phase],
+            static_cast<unsigned long long>(histogram.Count()),
+            static_cast<unsigned long long>(histogram.Sum()));
+
+        for (uint8_t index = 0; index < Histogram::Buckets; index++) {
+            Append(result, "%s%llu", (index == 0 ? "" : ","),
+                static_cast<unsigned long long>(histogram.Bucket(index)));
+        }
+        result += "]}";
+    }
+    result += '}';
+}
+
+} // namespace Metrics
+} // namespace CDMi
@@ -0,0 +1,175 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Module.h"
+#include "cdm.h"
+
+#include <atomic>
+#include <time.h>
+
+namespace CDMi {
+namespace Metrics {
+
+enum Phase : uint8_t {
+    LOCK_WAIT,   // waiting for the session lock on the decrypt paths
+    KEY_LOOKUP,  // resolving (and if needed refreshing) the key status
+    CDM_DECRYPT, // inside widevine::Cdm::decrypt
+    UPDATE,      // inside widevine::Cdm::update
+    LOAD,        // inside widevine::Cdm::load
+    MESSAGE,     // delivering a license message to the application
+    DISPATCH,    // from the CDM event to the completed application callback
+    PHASES
+};
+
+// The widevine::Cdm::Status values counted on their own, named after them.
+// The CDM numbers them sparsely (1-4, 101-104, 99999), hence the mapping.
+enum Failure : uint8_t {
+    TYPE_ERROR,
+    NOT_SUPPORTED,
+    INVALID_STATE,
+    QUOTA_EXCEEDED,
+    NEEDS_DEVICE_CERTIFICATE,
+    SESSION_NOT_FOUND,
+    DECRYPT_ERROR,
+    NO_KEY,
+    UNEXPECTED_ERROR,
+    OTHER_STATUS, // any status this plugin does not know of
+    FAILURES
+};
+
+inline Failure FailureOf(const widevine::Cdm::Status status)
+{
+    Failure result = OTHER_STATUS;
+
+    switch (status) {
+    case widevine::Cdm::kTypeError: result = TYPE_ERROR; break;
+    case widevine::Cdm::kNotSupported: result = NOT_SUPPORTED; break;
+    case widevine::Cdm::kInvalidState: result = INVALID_STATE; break;
+    case widevine::Cdm::kQuotaExceeded: result = QUOTA_EXCEEDED; break;
+    case widevine::Cdm::kNeedsDeviceCertificate: result = NEEDS_DEVICE_CERTIFICATE; break;
+    case widevine::Cdm::kSessionNotFound: result = SESSION_NOT_FOUND; break;
+    case widevine::Cdm::kDecryptError: result = DECRYPT_ERROR; break;
+    case widevine::Cdm::kNoKey: result = NO_KEY; break;
+    case widevine::Cdm::kUnexpectedError: result = UNEXPECTED_ERROR; break;
+    default: break;
+    }
+    return (result);
+}
+
+// Collection is off by default, when off every probe is a single relaxed load.
+void Enable(const bool enabled);
+bool IsEnabled();
+
+// Microseconds on the monotonic clock, 0 when collection is disabled.
+inline uint64_t Timestamp()
+{
+    uint64_t result = 0;
+    if (IsEnabled() == true) {
+        struct timespec now;
+        ::clock_gettime(CLOCK_MONOTONIC, &now);
+        result = (static_cast<uint64_t>(now.tv_sec) * 1000000) + (now.tv_nsec / 1000);
+    }
+    return (result);
+}
+
+// Lock free latency histogram with log2 buckets: bucket n counts durations
+// in [2^n, 2^(n+1)) microseconds, the last bucket everything above.
+class Histogram {
+public:
+    static constexpr uint8_t Buckets = 24;
+
+public:
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    Histogram();
+    ~Histogram() = default;
+
+public:
+    void Add(const uint64_t duration);
+    void Merge(const Histogram& other);
+
+    inline uint64_t Count() const {
+        return (_count.load(std::memory_order_relaxed));
+    }
+    inline uint64_t Sum() const {
+        return (_sum.load(std::memory_order_relaxed));
+    }
+    inline uint64_t Bucket(const uint8_t index) const {
+        return (_buckets[index].load(std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _sum;
+    std::atomic<uint64_t> _buckets[Buckets];
+};
+
+// Per session counters, updated without locks from the session threads.
+class Session {
+public:
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    Session();
+    ~Session() = default;
+
+public:
+    // Records the time elapsed since start, a 0 start (disabled) is ignored.
+    inline void Measure(const Phase phase, const uint64_t start) {
+        if (start != 0) {
+            const uint64_t end = Timestamp();
+            _phases[phase].Add(end > start ? end - start : 0);
+        }
+    }
+    // One successful CDM decrypt call.
+    inline void Decrypted(const uint32_t bytes) {
+        if (IsEnabled() == true) {
+            _calls.fetch_add(1, std::memory_order_relaxed);
+            _bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+    }
+    inline void NoKey() {
+        if (IsEnabled() == true) {
+            _noKey.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    inline void Failed(const widevine::Cdm::Status status) {
+        if (IsEnabled() == true) {
+            _failures[FailureOf(status)].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void Merge(const Session& other);
+
+    // Appends this session as a JSON object.
+    void ToString(std::string& result) const;
+
+private:
+    Histogram _phases[PHASES];
+    std::atomic<uint64_t> _calls;
+    std::atomic<uint64_t> _bytes;
+    std::atomic<uint64_t> _noKey;
+    std::atomic<uint64_t> _failures[FAILURES];
+};
+
+} // namespace Metrics
+} // namespace CDMi
@@ -25,3 +25,10 @@
 
 #include <core/core.h>
 #include <plugins/plugins.h>
+
+// Threads are Thunder::Core::Thread and plain mutual exclusion uses
+// Thunder::Core::CriticalSection. State that a thread sleeps on until another
+// thread changes it (timer wheel, event dispatcher, decrypt workers, CDM
+// start-up, key waits) is guarded by a std::mutex with a
+// std::condition_variable instead: CriticalSection has no condition wait,
+// and checking the state and then waiting on a Core::Event loses wake-ups.
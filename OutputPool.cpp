@@ -0,0 +1,116 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OutputPool.h"
+
+namespace CDMi {
+
+constexpr uint8_t OutputPool::MaxSlots;
+
+OutputPool::OutputPool()
+    : _free(0)
+    , _all(0)
+    , _buffer(nullptr)
+    , _slotSize(0)
+    , _slotCount(0)
+{
+}
+
+bool OutputPool::Register(uint8_t* buffer, const uint32_t slotSize, const uint8_t slotCount)
+{
+    if ((buffer == nullptr) || (slotSize == 0) || (slotCount == 0) || (slotCount > MaxSlots) || (_all.load(std::memory_order_relaxed) != 0)) {
+        return (false);
+    }
+
+    const uint64_t all = (slotCount == 64 ? ~static_cast<uint64_t>(0) : ((static_cast<uint64_t>(1) << slotCount) - 1));
+
+    _buffer.store(buffer, std::memory_order_relaxed);
+    _slotSize.store(slotSize, std::memory_order_relaxed);
+    _slotCount.store(slotCount, std::memory_order_relaxed);
+    _all.store(all, std::memory_order_relaxed);
+
+    // Publishing the free slots makes the layout above visible to Acquire.
+    _free.store(all, std::memory_order_release);
+
+    return (true);
+}
+
+bool OutputPool::Unregister()
+{
+    uint64_t expected = _all.load(std::memory_order_relaxed);
+
+    // Only when all slots are back, taking them all keeps Acquire out
+    // before the layout is cleared.
+    if ((expected == 0) || (_free.compare_exchange_strong(expected, 0, std::memory_order_acq_rel) == false)) {
+        return (false);
+    }
+
+    _buffer.store(nullptr, std::memory_order_relaxed);
+    _slotSize.store(0, std::memory_order_relaxed);
+    _slotCount.store(0, std::memory_order_relaxed);
+    _all.store(0, std::memory_order_relaxed);
+
+    return (true);
+}
+
+uint8_t* OutputPool::Acquire(const uint32_t size)
+{
+    uint64_t free = _free.load(std::memory_order_acquire);
+
+    while (free != 0) {
+        const uint32_t slotSize = _slotSize.load(std::memory_order_relaxed);
+
+        if (size > slotSize) {
+            return (nullptr);
+        }
+
+        const uint64_t slot = free & (~free + 1);
+
+        if (_free.compare_exchange_weak(free, free & ~slot, std::memory_order_acq_rel) == true) {
+            return (&(_buffer.load(std::memory_order_relaxed)[static_cast<uint64_t>(__builtin_ctzll(slot)) * slotSize]));
+        }
+    }
+
+    return (nullptr);
+}
+
+bool OutputPool::Release(const uint8_t* slot)
+{
+    // A slot that is out keeps the pool registered, anything else (e.g. a
+    // sample decrypted in place) must not match, whatever the owner does.
+    const uint8_t* buffer = _buffer.load(std::memory_order_relaxed);
+    const uint32_t slotSize = _slotSize.load(std::memory_order_relaxed);
+    const uint8_t slotCount = _slotCount.load(std::memory_order_relaxed);
+
+    if ((buffer == nullptr) || (slotSize == 0) || (slot < buffer) || (slot >= (buffer + (static_cast<uint64_t>(slotSize) * slotCount)))) {
+        return (false);
+    }
+
+    const uint64_t offset = static_cast<uint64_t>(slot - buffer);
+
+    if ((offset % slotSize) != 0) {
+        return (false);
+    }
+
+    _free.fetch_or(static_cast<uint64_t>(1) << (offset / slotSize), std::memory_order_release);
+
+    return (true);
+}
+
+} // namespace CDMi
@@ -0,0 +1,67 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Module.h"
+
+#include <atomic>
+
+namespace CDMi {
+
+// Slots of a caller provided, shared (typically memfd backed) buffer that
+// Decrypt writes the clear samples into, instead of decrypting in place.
+// The caller passes the slot on to the decoder without copying it and
+// hands it back with ReleaseClearContent. Acquire and Release are lock
+// free, a pool can only be unregistered while none of its slots is out.
+// Register and Unregister are made by the owner of the pool (one session),
+// Acquire and Release may run concurrently with them: the layout is only
+// read once _free, stored last by Register and taken first by Unregister,
+// says the pool is live.
+class OutputPool {
+public:
+    static constexpr uint8_t MaxSlots = 64;
+
+public:
+    OutputPool(const OutputPool&) = delete;
+    OutputPool& operator=(const OutputPool&) = delete;
+
+    OutputPool();
+    ~OutputPool() = default;
+
+public:
+    // The buffer must hold slotCount slots of slotSize bytes and stay mapped
+    // until Unregister succeeded.
+    bool Register(uint8_t* buffer, const uint32_t slotSize, const uint8_t slotCount);
+    bool Unregister();
+
+    // A free slot of at least size bytes, nullptr if there is none.
+    uint8_t* Acquire(const uint32_t size);
+    // False if the buffer is not a slot of this pool.
+    bool Release(const uint8_t* slot);
+
+private:
+    std::atomic<uint64_t> _free;
+    std::atomic<uint64_t> _all;
+    std::atomic<uint8_t*> _buffer;
+    std::atomic<uint32_t> _slotSize;
+    std::atomic<uint8_t> _slotCount;
+};
+
+} // namespace CDMi
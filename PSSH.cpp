@@ -0,0 +1,177 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PSSH.h"
+
+#include <string.h>
+
+namespace CDMi {
+namespace PSSH {
+
+static constexpr uint8_t g_widevineSystemId[16] = {
+    0xed, 0xef, 0x8b, 0xa9, 0x79, 0xd6, 0x4a, 0xce, 0xa3, 0xc8, 0x27, 0xdc, 0xd5, 0x1d, 0x21, 0xed
+};
+
+static uint32_t ReadUInt32(const uint8_t* data)
+{
+    return ((static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) | (static_cast<uint32_t>(data[2]) << 8) | data[3]);
+}
+
+static void Add(const uint8_t* keyId, KeyIds& keyIds)
+{
+    for (const KeyId& entry : keyIds) {
+        if (::memcmp(entry.bytes, keyId, sizeof(entry.bytes)) == 0) {
+            return;
+        }
+    }
+    keyIds.emplace_back();
+    ::memcpy(keyIds.back().bytes, keyId, sizeof(KeyId::bytes));
+}
+
+static bool ReadVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (uint8_t shift = 0; (data < end) && (shift < 64); shift += 7) {
+        const uint8_t byte = *data++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return (true);
+        }
+    }
+    return (false);
+}
+
+// The Widevine PSSH data is a WidevinePsshData protobuf message, key ids
+// are field 2 (bytes, repeated). Only that field is looked at.
+static bool ParseWidevineData(const uint8_t* data, const uint8_t* end, KeyIds& keyIds)
+{
+    while (data < end) {
+        uint64_t tag;
+        uint64_t value;
+
+        if (ReadVarint(data, end, tag) == false) {
+            return (false);
+        }
+
+        switch (tag & 0x07) {
+        case 0: // varint
+            if (ReadVarint(data, end, value) == false) {
+                return (false);
+            }
+            break;
+        case 1: // 64 bit
+            if ((end - data) < 8) {
+                return (false);
+            }
+            data += 8;
+            break;
+        case 2: // length delimited
+            if ((ReadVarint(data, end, value) == false) || (value > static_cast<uint64_t>(end - data))) {
+                return (false);
+            }
+            if (((tag >> 3) == 2) && (value == sizeof(KeyId::bytes))) {
+                Add(data, keyIds);
+            }
+            data += value;
+            break;
+        case 5: // 32 bit
+            if ((end - data) < 4) {
+                return (false);
+            }
+            data += 4;
+            break;
+        default:
+            return (false);
+        }
+    }
+    return (true);
+}
+
+bool Parse(const uint8_t* data, const uint32_t length, KeyIds& keyIds)
+{
+    const uint8_t* const end = data + length;
+    bool found = false;
+
+    keyIds.clear();
+
+    while ((end - data) >= 8) {
+        uint64_t size = ReadUInt32(data);
+        uint32_t header = 8;
+
+        if (size == 1) {
+            // 64 bit largesize follows the type.
+            if ((end - data) < 16) {
+                return (false);
+            }
+            size = (static_cast<uint64_t>(ReadUInt32(&data[8])) << 32) | ReadUInt32(&data[12]);
+            header = 16;
+        } else if (size == 0) {
+            // Extends to the end of the data.
+            size = static_cast<uint64_t>(end - data);
+        }
+
+        if ((size < header) || (size > static_cast<uint64_t>(end - data))) {
+            return (false);
+        }
+
+        const uint8_t* box = data + header;
+        const uint8_t* const boxEnd = data + size;
+
+        // FullBox: version and flags, then the system id.
+        if ((::memcmp(&data[4], "pssh", 4) == 0) && ((boxEnd - box) >= 20) && (::memcmp(&box[4], g_widevineSystemId, sizeof(g_widevineSystemId)) == 0)) {
+            const uint8_t version = box[0];
+
+            box += 20;
+
+            if (version > 0) {
+                if ((boxEnd - box) < 4) {
+                    return (false);
+                }
+                const uint32_t count = ReadUInt32(box);
+                box += 4;
+
+                if (count > static_cast<uint64_t>(boxEnd - box) / sizeof(KeyId::bytes)) {
+                    return (false);
+                }
+                for (uint32_t index = 0; index < count; index++, box += sizeof(KeyId::bytes)) {
+                    Add(box, keyIds);
+                }
+            }
+
+            if ((boxEnd - box) < 4) {
+                return (false);
+            }
+            const uint32_t dataSize = ReadUInt32(box);
+            box += 4;
+
+            if ((dataSize > static_cast<uint64_t>(boxEnd - box)) || (ParseWidevineData(box, box + dataSize, keyIds) == false)) {
+                return (false);
+            }
+
+            found = true;
+        }
+
+        data = boxEnd;
+    }
+
+    return (found);
+}
+
+} // namespace PSSH
+} // namespace CDMi
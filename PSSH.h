@@ -0,0 +1,43 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Module.h"
+
+#include <vector>
+
+namespace CDMi {
+namespace PSSH {
+
+// Widevine key ids are 16 bytes.
+struct KeyId {
+    uint8_t bytes[16];
+};
+typedef std::vector<KeyId> KeyIds;
+
+// Walks the 'pssh' boxes of cenc init data and collects the key ids of the
+// boxes carrying the Widevine system id: the key id list of version 1 boxes
+// and the key_id fields of the Widevine PSSH data. Boxes of other systems
+// (PlayReady, ...) are skipped, duplicate key ids are reported once.
+// Returns false if the init data is malformed or holds no Widevine box.
+bool Parse(const uint8_t* data, const uint32_t length, KeyIds& keyIds);
+
+} // namespace PSSH
+} // namespace CDMi
@@ -0,0 +1,267 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TimerWheel.h"
+
+#include <time.h>
+
+using namespace Thunder;
+
+namespace CDMi {
+
+TimerWheel::TimerWheel(const uint32_t resolution)
+  : Core::Thread(Core::Thread::DefaultStackSize(), _T("widevine"))
+  , _resolution(resolution > 0 ? resolution : 1)
+  , _lock()
+  , _signal()
+  , _running(true)
+  , _current(0)
+  , _count(0)
+  , _slots()
+  , _due()
+  , _clients()
+  , _firing(nullptr) {
+
+  _current = Ticks();
+
+  Core::Thread::Run();
+}
+
+TimerWheel::~TimerWheel() {
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    _running = false;
+  }
+  Core::Thread::Stop();
+  _signal.notify_all();
+  Core::Thread::Wait(Core::Thread::STOPPED, Core::infinite);
+
+  for (ClientMap::iterator client = _clients.begin(); client != _clients.end(); client++) {
+    for (ContextMap::iterator context = client->second.begin(); context != client->second.end(); context++) {
+      delete context->second;
+    }
+  }
+}
+
+void TimerWheel::Schedule(const uint64_t delay, IClient* client, void* context) {
+  ASSERT(client != nullptr);
+
+  // Round up and account for the partially elapsed current tick, a timer
+  // must never fire early.
+  const uint64_t ticks = ((delay + _resolution - 1) / _resolution) + 1;
+
+  std::unique_lock<std::mutex> lock(_lock);
+
+  Entry*& entry(_clients[client][context]);
+
+  if (entry == nullptr) {
+    entry = new Entry();
+    entry->client = client;
+    entry->context = context;
+    _count++;
+  } else {
+    entry->Unlink();
+  }
+
+  entry->expiry = Ticks() + ticks;
+
+  Insert(entry);
+
+  lock.unlock();
+
+  // The worker might be sleeping past the new expiry.
+  _signal.notify_all();
+}
+
+void TimerWheel::Revoke(IClient* client, void* context) {
+  std::unique_lock<std::mutex> lock(_lock);
+
+  ClientMap::iterator entries(_clients.find(client));
+
+  if (entries != _clients.end()) {
+    ContextMap::iterator index(entries->second.find(context));
+
+    if (index != entries->second.end()) {
+      Entry* entry = index->second;
+      entries->second.erase(index);
+      if (entries->second.empty() == true) {
+        _clients.erase(entries);
+      }
+      entry->Unlink();
+      delete entry;
+      _count--;
+    }
+  }
+
+  WaitForCallback(client, lock);
+}
+
+void TimerWheel::Revoke(IClient* client) {
+  std::unique_lock<std::mutex> lock(_lock);
+
+  ClientMap::iterator entries(_clients.find(client));
+
+  if (entries != _clients.end()) {
+    for (ContextMap::iterator index = entries->second.begin(); index != entries->second.end(); index++) {
+      index->second->Unlink();
+      delete index->second;
+      _count--;
+    }
+    _clients.erase(entries);
+  }
+
+  WaitForCallback(client, lock);
+}
+
+void TimerWheel::WaitForCallback(IClient* client, std::unique_lock<std::mutex>& lock) {
+  // Revoking from within a callback must not wait for itself.
+  if (Core::Thread::ThreadId() != Core::Thread::Id()) {
+    _signal.wait(lock, [this, client]() { return (_firing != client); });
+  }
+}
+
+uint64_t TimerWheel::Ticks() const {
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  const uint64_t milliseconds = (static_cast<uint64_t>(now.tv_sec) * 1000) + (now.tv_nsec / 1000000);
+  return (milliseconds / _resolution);
+}
+
+// Must be called with _lock held. An entry that expires beyond the reach
+// of the wheel is parked in the furthest slot, each time that slot cascades
+// it moves on until it is within reach.
+void TimerWheel::Insert(Entry* entry) {
+  if (entry->expiry < _current) {
+    entry->expiry = _current;
+  }
+
+  const uint64_t delta = ((entry->expiry - _current) > MaxDelay ? MaxDelay : (entry->expiry - _current));
+  const uint64_t position = _current + delta;
+  uint8_t level = 0;
+
+  while ((level < (Levels - 1)) && (delta >= (static_cast<uint64_t>(1) << (LevelBits * (level + 1))))) {
+    level++;
+  }
+
+  _slots[level][(position >> (LevelBits * level)) & SlotMask].Append(entry);
+}
+
+// Must be called with _lock held. Redistributes the entries of a higher
+// level slot over the lower levels.
+void TimerWheel::Cascade(const uint8_t level, const uint32_t index) {
+  Entry& slot(_slots[level][index]);
+
+  while (slot.IsEmpty() == false) {
+    Entry* entry = slot.next;
+    entry->Unlink();
+    Insert(entry);
+  }
+}
+
+// Must be called with _lock held. Moves everything that expired up to and
+// including the given tick to the due list.
+void TimerWheel::Advance(const uint64_t ticks) {
+  while (_current <= ticks) {
+    const uint32_t index = static_cast<uint32_t>(_current & SlotMask);
+
+    if (index == 0) {
+      for (uint8_t level = 1; level < Levels; level++) {
+        const uint32_t upper = static_cast<uint32_t>((_current >> (LevelBits * level)) & SlotMask);
+        Cascade(level, upper);
+        if (upper != 0) {
+          break;
+        }
+      }
+    }
+
+    Entry& slot(_slots[0][index]);
+    while (slot.IsEmpty() == false) {
+      Entry* entry = slot.next;
+      entry->Unlink();
+      _due.Append(entry);
+    }
+
+    _current++;
+  }
+}
+
+// Must be called with _lock held. Returns the tick at which the wheel next
+// needs attention: the first occupied slot of this round, or the next cascade.
+uint64_t TimerWheel::NextTick() const {
+  const uint64_t base = (_current & ~SlotMask);
+
+  for (uint32_t index = static_cast<uint32_t>(_current & SlotMask); index < Slots; index++) {
+    if (_slots[0][index].IsEmpty() == false) {
+      return (base + index);
+    }
+  }
+  return (base + Slots);
+}
+
+uint32_t TimerWheel::Worker() {
+  std::unique_lock<std::mutex> lock(_lock);
+
+  if (_running == true) {
+    Advance(Ticks());
+
+    // Fire one at a time, the entry stays revocable until its callback is
+    // actually invoked.
+    while (_due.IsEmpty() == false) {
+      Entry* entry = _due.next;
+      IClient* client = entry->client;
+      void* context = entry->context;
+
+      ClientMap::iterator entries(_clients.find(client));
+      ASSERT(entries != _clients.end());
+      entries->second.erase(context);
+      if (entries->second.empty() == true) {
+        _clients.erase(entries);
+      }
+      entry->Unlink();
+      delete entry;
+      _count--;
+
+      _firing = client;
+      lock.unlock();
+
+      client->onTimerExpired(context);
+
+      lock.lock();
+      _firing = nullptr;
+      _signal.notify_all();
+    }
+
+    if (_running == true) {
+      if (_count == 0) {
+        _signal.wait(lock);
+      } else {
+        const uint64_t now = Ticks();
+        const uint64_t next = NextTick();
+
+        if (next > now) {
+          _signal.wait_for(lock, std::chrono::milliseconds((next - now) * _resolution));
+        }
+      }
+    }
+  }
+
+  return (0);
+}
+
+} // namespace CDMi
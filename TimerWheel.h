@@ -0,0 +1,127 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Module.h"
+#include "cdm.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+
+namespace CDMi {
+
+// Hierarchical timing wheel (4 levels of 64 slots) backing the
+// widevine::Cdm::ITimer implementation. Timers are keyed on (client,
+// context): scheduling and revoking are O(1), regardless of the number of
+// outstanding timers. All callbacks are fired from one dedicated thread.
+class TimerWheel : public Thunder::Core::Thread {
+public:
+  typedef widevine::Cdm::ITimer::IClient IClient;
+
+private:
+  static constexpr uint8_t LevelBits = 6;
+  static constexpr uint8_t Levels = 4;
+  static constexpr uint32_t Slots = (1 << LevelBits);
+  static constexpr uint64_t SlotMask = (Slots - 1);
+  static constexpr uint64_t MaxDelay = (static_cast<uint64_t>(1) << (LevelBits * Levels)) - 1; // in ticks
+
+  // Entries live on intrusive, circular lists: either a wheel slot or the
+  // list of entries that are due. The slot heads are sentinels.
+  struct Entry {
+    Entry() : client(nullptr), context(nullptr), expiry(0), previous(this), next(this) {
+    }
+
+    inline bool IsEmpty() const {
+      return (next == this);
+    }
+    inline void Unlink() {
+      previous->next = next;
+      next->previous = previous;
+      previous = this;
+      next = this;
+    }
+    inline void Append(Entry* entry) {
+      entry->previous = previous;
+      entry->next = this;
+      previous->next = entry;
+      previous = entry;
+    }
+
+    IClient* client;
+    void* context;
+    uint64_t expiry; // in ticks, might be beyond the reach of the wheel
+    Entry* previous;
+    Entry* next;
+  };
+
+  typedef std::unordered_map<void*, Entry*> ContextMap;
+  typedef std::unordered_map<IClient*, ContextMap> ClientMap;
+
+public:
+  TimerWheel() = delete;
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator= (const TimerWheel&) = delete;
+
+  // Resolution in milliseconds, timers never fire early.
+  explicit TimerWheel(const uint32_t resolution);
+  ~TimerWheel() override;
+
+public:
+  // Fires client->onTimerExpired(context) after delay milliseconds. An
+  // outstanding timer with the same client and context is replaced.
+  void Schedule(const uint64_t delay, IClient* client, void* context);
+
+  // Revokes the timer of the given client and context.
+  void Revoke(IClient* client, void* context);
+
+  // Revokes all timers of the given client. If one of its callbacks is
+  // running on the timer thread, this waits for it to complete, so the
+  // client can safely be destructed afterwards. Called from within that
+  // callback it does not wait.
+  // note the caller must not hold a lock that the client's callbacks take,
+  //      the wait would never end. The same goes for Revoke(client, context).
+  void Revoke(IClient* client);
+
+private:
+  uint32_t Worker() override;
+
+  uint64_t Ticks() const;
+  void Insert(Entry* entry);
+  void Remove(Entry* entry);
+  void Cascade(const uint8_t level, const uint32_t index);
+  void Advance(const uint64_t ticks);
+  uint64_t NextTick() const;
+  void WaitForCallback(IClient* client, std::unique_lock<std::mutex>& lock);
+
+private:
+  const uint32_t _resolution;
+  mutable std::mutex _lock;
+  std::condition_variable _signal;
+  bool _running;
+  uint64_t _current; // next tick to process
+  uint32_t _count;
+  Entry _slots[Levels][Slots];
+  Entry _due;
+  ClientMap _clients;
+  IClient* _firing;
+};
+
+} // namespace CDMi
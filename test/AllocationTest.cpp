@@ -0,0 +1,80 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The steady state decrypt paths make no heap allocations: the scratch data
+// comes from the session's arena, the key statuses from its cached table.
+
+#include "Allocations.h"
+#include "Helpers.h"
+
+#include <Extensions.h>
+
+int main()
+{
+    static constexpr uint32_t Warmup = 4;
+    static constexpr uint32_t Iterations = 100;
+    static constexpr uint32_t Size = 8 * 1024;
+
+    CDMi::IMediaKeys* system = Test::System("{}");
+    EXPECT(system != nullptr);
+
+    const Test::Key key(Test::MakeKey(31));
+    Test::Callback callback;
+    CDMi::IMediaKeySession* session = Test::Open(system, callback, { key });
+    EXPECT(session != nullptr);
+
+    CDMi::IMediaKeySessionDecrypt* decrypt = dynamic_cast<CDMi::IMediaKeySessionDecrypt*>(session);
+    EXPECT(decrypt != nullptr);
+
+    if ((session != nullptr) && (decrypt != nullptr)) {
+        const CDMi::EncryptionPattern none = { 0, 0 };
+        const CDMi::EncryptionPattern pattern = { 1, 9 };
+        const CDMi::IMediaKeySessionDecrypt::SubSample subSamples[] = { { 100, 4000 }, { 60, 4032 } };
+        uint8_t iv[16] = { 7 };
+        std::vector<uint8_t> sample(Size);
+
+        const auto round = [&]() {
+            bool result = true;
+            result = (Test::Decrypt(session, CDMi::AesCtr_Cenc, none, key, iv, sample.data(), Size) == CDMi::CDMi_SUCCESS) && result;
+            result = (Test::Decrypt(session, CDMi::AesCbc_Cbc1, none, key, iv, sample.data(), Size) == CDMi::CDMi_SUCCESS) && result;
+            result = (decrypt->DecryptSubSamples(CDMi::AesCtr_Cenc, none, iv, sizeof(iv), sample.data(), Size,
+                          subSamples, 2, sizeof(key.id), key.id) == CDMi::CDMi_SUCCESS) && result;
+            result = (decrypt->DecryptSubSamples(CDMi::AesCbc_Cbcs, pattern, iv, sizeof(iv), sample.data(), Size,
+                          subSamples, 2, sizeof(key.id), key.id) == CDMi::CDMi_SUCCESS) && result;
+            return (result);
+        };
+
+        for (uint32_t index = 0; index < Warmup; index++) {
+            EXPECT(round() == true);
+        }
+
+        const uint64_t allocations = Test::ThreadAllocations();
+
+        for (uint32_t index = 0; index < Iterations; index++) {
+            EXPECT(round() == true);
+        }
+
+        EXPECT(Test::ThreadAllocations() == allocations);
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
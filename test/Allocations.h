@@ -0,0 +1,84 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// Counts the heap allocations of the program, by replacing the global
+// operator new. Include it in exactly one source file of an executable.
+
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace Test {
+
+static std::atomic<uint64_t> g_allocations(0);
+static thread_local uint64_t t_allocations = 0;
+
+// All threads, since the start of the program.
+inline uint64_t Allocations()
+{
+    return (g_allocations.load(std::memory_order_relaxed));
+}
+
+// The calling thread only, unaffected by the plugin's background threads.
+inline uint64_t ThreadAllocations()
+{
+    return (t_allocations);
+}
+
+} // namespace Test
+
+void* operator new(size_t size)
+{
+    Test::g_allocations.fetch_add(1, std::memory_order_relaxed);
+    Test::t_allocations++;
+
+    void* result = ::malloc(size > 0 ? size : 1);
+    if (result == nullptr) {
+        throw std::bad_alloc();
+    }
+    return (result);
+}
+
+void* operator new[](size_t size)
+{
+    return (::operator new(size));
+}
+
+void operator delete(void* pointer) noexcept
+{
+    ::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    ::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    ::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+    ::free(pointer);
+}
@@ -0,0 +1,81 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Bringing the CDM up off the activation path: Initialize returns while
+// the CDM still initializes, the sessions created meanwhile wait for it.
+
+#include "Helpers.h"
+
+#include <thread>
+
+int main()
+{
+    static constexpr uint32_t InitializeDelay = 300; // ms
+
+    Stub::InitializeDelay(InitializeDelay);
+
+    const uint64_t start = Test::Now();
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":0}");
+    EXPECT(system != nullptr);
+    EXPECT((Test::Now() - start) < ((InitializeDelay * 1000) / 2));
+
+    const Test::Key key(Test::MakeKey(1));
+    const std::string initData(Test::Pssh({ key }));
+    CDMi::IMediaKeySession* sessions[2] = { nullptr, nullptr };
+    CDMi::CDMi_RESULT results[2] = { CDMi::CDMi_S_FALSE, CDMi::CDMi_S_FALSE };
+
+    auto create = [&](const uint8_t index) {
+        results[index] = system->CreateMediaKeySession("com.widevine.alpha", CDMi::Temporary, "cenc",
+            reinterpret_cast<const uint8_t*>(initData.data()), static_cast<uint32_t>(initData.size()),
+            nullptr, 0, &(sessions[index]));
+    };
+
+    // Both queue behind the CDM.
+    std::thread other(create, 1);
+    create(0);
+    other.join();
+
+    EXPECT((Test::Now() - start) >= (InitializeDelay * 1000));
+    EXPECT(Stub::CreatedSessions() == 2);
+
+    for (uint8_t index = 0; index < 2; index++) {
+        EXPECT(results[index] == CDMi::CDMi_SUCCESS);
+
+        if (sessions[index] != nullptr) {
+            Test::Callback callback;
+            sessions[index]->Run(&callback);
+            EXPECT(callback.WaitForMessages(1) == true);
+            sessions[index]->Close();
+            system->DestroyMediaKeySession(sessions[index]);
+        }
+    }
+
+    // Ready from here on, no more waiting.
+    const uint64_t ready = Test::Now();
+    create(0);
+    EXPECT(results[0] == CDMi::CDMi_SUCCESS);
+    EXPECT((Test::Now() - ready) < ((InitializeDelay * 1000) / 2));
+
+    if (sessions[0] != nullptr) {
+        sessions[0]->Close();
+        system->DestroyMediaKeySession(sessions[0]);
+    }
+
+    return (Test::Result());
+}
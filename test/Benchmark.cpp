@@ -0,0 +1,686 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Runs the plugin against the stub widevine::Cdm and reports operations
+// per second and latency percentiles (in microseconds) per scenario:
+//
+//   widevine-benchmark [sessions] [iterations] [sample size]
+
+#include "Allocations.h"
+#include "Helpers.h"
+
+#include <DecryptEngine.h>
+#include <Extensions.h>
+#include <HostImplementation.h>
+#include <PSSH.h>
+#include <TimerWheel.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+struct Options {
+    uint32_t sessions;
+    uint32_t iterations;
+    uint32_t sampleSize;
+};
+
+void Report(const char* scenario, std::vector<uint64_t>& latencies, const uint64_t elapsed)
+{
+    if (latencies.empty() == true) {
+        return;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    const auto percentile = [&latencies](const uint32_t rank) {
+        return (static_cast<unsigned long long>(latencies[(latencies.size() - 1) * rank / 100]));
+    };
+
+    ::printf("%-32s %10.0f ops/s  p50 %6llu  p90 %6llu  p99 %6llu  max %6llu\n", scenario,
+        (elapsed > 0 ? (latencies.size() * 1000000.0) / elapsed : 0.0),
+        percentile(50), percentile(90), percentile(99), static_cast<unsigned long long>(latencies.back()));
+}
+
+// CreateMediaKeySession, Run and the license round trip up to usable keys.
+bool Sessions(CDMi::IMediaKeys* system, const Options& options, std::vector<CDMi::IMediaKeySession*>& sessions, std::vector<Test::Callback*>& callbacks)
+{
+    std::vector<uint64_t> latencies;
+    const uint64_t begin = Test::Now();
+
+    for (uint32_t index = 0; index < options.sessions; index++) {
+        const Test::Key key(Test::MakeKey(static_cast<uint8_t>(index)));
+        Test::Callback* callback = new Test::Callback();
+
+        const uint64_t start = Test::Now();
+        CDMi::IMediaKeySession* session = Test::Open(system, *callback, { key });
+        latencies.push_back(Test::Now() - start);
+
+        callbacks.push_back(callback);
+
+        if (session == nullptr) {
+            ::fprintf(stderr, "creating session %u failed\n", index);
+            return (false);
+        }
+        sessions.push_back(session);
+    }
+
+    Report("session setup", latencies, Test::Now() - begin);
+    return (true);
+}
+
+// License renewal round trips: the CDM's request delivered to the
+// application and its response loaded with Update, round robin over the
+// sessions. Reports the heap allocations per round trip as well, the stub
+// CDM's own included. The key status change of the previous Update is held
+// back for the batching window and the renewal queues behind it.
+void Renewals(const Options& options, const std::vector<CDMi::IMediaKeySession*>& sessions, const std::vector<Test::Callback*>& callbacks)
+{
+    const uint32_t iterations = std::min(options.iterations, 100u);
+    std::vector<uint64_t> latencies;
+
+    std::vector<std::string> licenses;
+    std::vector<std::string> sessionIds;
+
+    latencies.reserve(iterations);
+    for (uint32_t index = 0; index < sessions.size(); index++) {
+        licenses.push_back(Test::License({ Test::MakeKey(static_cast<uint8_t>(index)) }));
+        sessionIds.push_back(sessions[index]->GetSessionId());
+    }
+
+    const uint64_t allocations = Test::Allocations();
+    const uint64_t begin = Test::Now();
+
+    for (uint32_t index = 0; index < iterations; index++) {
+        const uint32_t session = index % sessions.size();
+        const uint32_t messages = callbacks[session]->Messages();
+
+        const uint64_t start = Test::Now();
+        Stub::Renew(sessionIds[session]);
+        callbacks[session]->WaitForMessages(messages + 1);
+        sessions[session]->Update(reinterpret_cast<const uint8_t*>(licenses[session].data()), static_cast<uint32_t>(licenses[session].size()));
+        latencies.push_back(Test::Now() - start);
+    }
+
+    const uint64_t elapsed = Test::Now() - begin;
+    const uint64_t allocated = Test::Allocations() - allocations;
+
+    Report("license renewal", latencies, elapsed);
+    ::printf("%-32s %10.1f allocations per round trip\n", "license renewal", static_cast<double>(allocated) / iterations);
+}
+
+// Full sample decrypts, round robin over the sessions.
+void Decrypts(const Options& options, const std::vector<CDMi::IMediaKeySession*>& sessions, const CDMi::EncryptionScheme scheme, const char* scenario)
+{
+    static const CDMi::EncryptionPattern none = { 0, 0 };
+
+    std::vector<uint8_t> sample(options.sampleSize);
+    std::vector<uint64_t> latencies;
+    uint8_t iv[16];
+
+    latencies.reserve(options.iterations);
+    ::memset(iv, 0, sizeof(iv));
+
+    const uint64_t begin = Test::Now();
+
+    for (uint32_t index = 0; index < options.iterations; index++) {
+        const uint32_t session = index % sessions.size();
+        const Test::Key key(Test::MakeKey(static_cast<uint8_t>(session)));
+
+        const uint64_t start = Test::Now();
+        Test::Decrypt(sessions[session], scheme, none, key, iv, sample.data(), options.sampleSize);
+        latencies.push_back(Test::Now() - start);
+    }
+
+    Report(scenario, latencies, Test::Now() - begin);
+}
+
+// Audio frame sized samples, one Decrypt each or batched through
+// DecryptSamples, reported per sample.
+void Batches(const Options& options, const std::vector<CDMi::IMediaKeySession*>& sessions)
+{
+    static const CDMi::EncryptionPattern none = { 0, 0 };
+    static constexpr uint32_t FrameSize = 384;
+
+    CDMi::IMediaKeySessionDecrypt* session = dynamic_cast<CDMi::IMediaKeySessionDecrypt*>(sessions[0]);
+    const Test::Key key(Test::MakeKey(0));
+
+    std::vector<uint8_t> frames(64 * FrameSize);
+    std::vector<CDMi::IMediaKeySessionDecrypt::Sample> samples(64);
+    uint8_t iv[16];
+
+    ::memset(iv, 0, sizeof(iv));
+
+    for (uint32_t index = 0; index < samples.size(); index++) {
+        samples[index].iv = iv;
+        samples[index].ivLength = sizeof(iv);
+        samples[index].data = &(frames[index * FrameSize]);
+        samples[index].length = FrameSize;
+    }
+
+    for (const uint32_t batch : { 1, 8, 64 }) {
+        std::vector<uint64_t> latencies;
+        const uint32_t rounds = std::max<uint32_t>(options.iterations / batch, 1);
+
+        latencies.reserve(rounds * batch);
+
+        const uint64_t begin = Test::Now();
+
+        for (uint32_t round = 0; round < rounds; round++) {
+            const uint64_t start = Test::Now();
+
+            if (batch == 1) {
+                Test::Decrypt(sessions[0], CDMi::AesCtr_Cenc, none, key, iv, samples[0].data, FrameSize);
+            } else {
+                session->DecryptSamples(CDMi::AesCtr_Cenc, none, samples.data(), batch, sizeof(key.id), key.id);
+            }
+
+            const uint64_t perSample = (Test::Now() - start) / batch;
+            latencies.insert(latencies.end(), batch, perSample);
+        }
+
+        char scenario[32];
+        ::snprintf(scenario, sizeof(scenario), "audio frame, batch of %u", batch);
+        Report(scenario, latencies, Test::Now() - begin);
+    }
+}
+
+// The same number of decrypts spread over 1, 2, 4, ... threads, each on
+// its own session. With per session locking the throughput scales with the
+// threads, until the cores run out.
+void Scaling(const Options& options, const std::vector<CDMi::IMediaKeySession*>& sessions)
+{
+    static const CDMi::EncryptionPattern none = { 0, 0 };
+
+    for (uint32_t threads = 1; threads <= sessions.size(); threads *= 2) {
+        std::vector<std::vector<uint64_t>> perThread(threads);
+        std::vector<std::thread> workers;
+        const uint32_t iterations = options.iterations / threads;
+
+        const uint64_t begin = Test::Now();
+
+        for (uint32_t thread = 0; thread < threads; thread++) {
+            workers.emplace_back([&, thread]() {
+                const Test::Key key(Test::MakeKey(static_cast<uint8_t>(thread)));
+                std::vector<uint8_t> sample(options.sampleSize);
+                std::vector<uint64_t>& latencies(perThread[thread]);
+                uint8_t iv[16];
+
+                ::memset(iv, 0, sizeof(iv));
+                latencies.reserve(iterations);
+
+                for (uint32_t index = 0; index < iterations; index++) {
+                    const uint64_t start = Test::Now();
+                    Test::Decrypt(sessions[thread], CDMi::AesCbc_Cbc1, none, key, iv, sample.data(), options.sampleSize);
+                    latencies.push_back(Test::Now() - start);
+                }
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        const uint64_t elapsed = Test::Now() - begin;
+        std::vector<uint64_t> latencies;
+        for (const std::vector<uint64_t>& entry : perThread) {
+            latencies.insert(latencies.end(), entry.begin(), entry.end());
+        }
+
+        char scenario[32];
+        ::snprintf(scenario, sizeof(scenario), "decrypt cbc1, %u thread(s)", threads);
+        Report(scenario, latencies, elapsed);
+    }
+}
+
+// The key ids of init data as the plugin reads them to find a donor, and
+// a session that shares the keys of a live one against the licensed
+// sessions above.
+void Sharing(CDMi::IMediaKeys* system, const Options& options, const std::vector<CDMi::IMediaKeySession*>& sessions)
+{
+    std::vector<Test::Key> keys;
+    for (uint8_t index = 0; index < 4; index++) {
+        keys.push_back(Test::MakeKey(index));
+    }
+    const std::string initData(Test::Pssh(keys));
+    std::vector<uint64_t> latencies;
+    CDMi::PSSH::KeyIds keyIds;
+
+    latencies.reserve(options.iterations);
+
+    uint64_t begin = Test::Now();
+
+    for (uint32_t index = 0; index < options.iterations; index++) {
+        const uint64_t start = Test::Now();
+        CDMi::PSSH::Parse(reinterpret_cast<const uint8_t*>(initData.data()), static_cast<uint32_t>(initData.size()), keyIds);
+        latencies.push_back(Test::Now() - start);
+    }
+
+    Report("pssh parse, 4 key ids", latencies, Test::Now() - begin);
+
+    // Creating sessions is slow, a thousand tell enough.
+    const uint32_t rounds = std::min<uint32_t>(options.iterations, 1000);
+
+    latencies.clear();
+    begin = Test::Now();
+
+    for (uint32_t index = 0; index < rounds; index++) {
+        const std::string shared(Test::Pssh({ Test::MakeKey(static_cast<uint8_t>(index % sessions.size())) }));
+        CDMi::IMediaKeySession* session = nullptr;
+        Test::Callback callback;
+
+        const uint64_t start = Test::Now();
+        if (system->CreateMediaKeySession("com.widevine.alpha", CDMi::Temporary, "cenc",
+                reinterpret_cast<const uint8_t*>(shared.data()), static_cast<uint32_t>(shared.size()),
+                nullptr, 0, &session) == CDMi::CDMi_SUCCESS) {
+            session->Run(&callback);
+            callback.WaitForUpdates(1);
+            latencies.push_back(Test::Now() - start);
+
+            session->Close();
+            system->DestroyMediaKeySession(session);
+        }
+    }
+
+    Report("shared session", latencies, Test::Now() - begin);
+}
+
+// A large sample split over the decrypt workers, as "decryptthreads" 1 to
+// 8 configures them. The submitting thread helps out, as it does in the
+// plugin.
+void Engine(const Options& options)
+{
+    static constexpr uint32_t Size = 1024 * 1024; // MB/s is samples/s
+    static const CDMi::EncryptionPattern none = { 0, 0 };
+
+    struct Range {
+        uint8_t* data;
+        uint32_t length;
+        uint8_t iv[16];
+    };
+
+    const Test::Key key(Test::MakeKey(0));
+    const uint32_t rounds = std::max<uint32_t>(options.iterations / 20, 10);
+    std::vector<uint8_t> sample(Size);
+    std::vector<Range> ranges(Size / CDMi::DecryptEngine::MinimumChunk);
+    std::vector<uint64_t> latencies;
+
+    for (uint32_t index = 0; index < ranges.size(); index++) {
+        ranges[index].data = &(sample[index * CDMi::DecryptEngine::MinimumChunk]);
+        ranges[index].length = CDMi::DecryptEngine::MinimumChunk;
+        ::memset(ranges[index].iv, static_cast<int>(index), sizeof(ranges[index].iv));
+    }
+
+    latencies.reserve(rounds);
+
+    for (uint8_t threads = 1; threads <= 8; threads++) {
+        CDMi::DecryptEngine engine;
+        engine.Start(threads);
+
+        latencies.clear();
+        const uint64_t begin = Test::Now();
+
+        for (uint32_t round = 0; round < rounds; round++) {
+            CDMi::DecryptEngine::Completion completion;
+            const uint64_t start = Test::Now();
+
+            for (Range& range : ranges) {
+                engine.Submit(completion, [&key, &range]() {
+                    Test::Encrypt(CDMi::AesCtr_Cenc, none, key, range.iv, range.data, range.length);
+                    return (true);
+                });
+            }
+            engine.Complete(completion);
+            latencies.push_back(Test::Now() - start);
+        }
+
+        char scenario[32];
+        ::snprintf(scenario, sizeof(scenario), "1 MB sample, %u worker(s)", threads);
+        Report(scenario, latencies, Test::Now() - begin);
+
+        engine.Stop();
+    }
+}
+
+// The CDM's file operations on license sized records, in memory and on
+// disk (where every write is synced).
+void Storage(const Options& options)
+{
+    static constexpr uint32_t Files = 64;
+
+    std::vector<std::string> names;
+    for (uint32_t index = 0; index < Files; index++) {
+        names.push_back("license" + std::to_string(index) + ".lic");
+    }
+    std::string record(2048, '\0');
+    Test::Fill(reinterpret_cast<uint8_t*>(&record[0]), static_cast<uint32_t>(record.size()), 7);
+
+    char directory[] = "/tmp/widevine-benchmark-XXXXXX";
+    if (::mkdtemp(directory) == nullptr) {
+        return;
+    }
+
+    for (const bool disk : { false, true }) {
+        CDMi::HostImplementation host;
+        if ((disk == true) && (host.Open(directory) == false)) {
+            break;
+        }
+
+        // Synced writes take milliseconds.
+        const uint32_t rounds = (disk == true ? std::min<uint32_t>(options.iterations, 500) : options.iterations);
+        std::vector<uint64_t> latencies;
+        std::string data;
+        char scenario[32];
+
+        latencies.reserve(rounds);
+        uint64_t begin = Test::Now();
+
+        for (uint32_t index = 0; index < rounds; index++) {
+            const uint64_t start = Test::Now();
+            host.write(names[index % Files], record);
+            latencies.push_back(Test::Now() - start);
+        }
+
+        ::snprintf(scenario, sizeof(scenario), "storage write, %s", (disk == true ? "disk" : "memory"));
+        Report(scenario, latencies, Test::Now() - begin);
+
+        latencies.clear();
+        begin = Test::Now();
+
+        for (uint32_t index = 0; index < rounds; index++) {
+            const uint64_t start = Test::Now();
+            host.read(names[index % Files], &data);
+            latencies.push_back(Test::Now() - start);
+        }
+
+        ::snprintf(scenario, sizeof(scenario), "storage read, %s", (disk == true ? "disk" : "memory"));
+        Report(scenario, latencies, Test::Now() - begin);
+
+        for (const std::string& name : names) {
+            host.remove(name);
+        }
+    }
+
+    ::rmdir(directory);
+}
+
+// IClock::now under each clock policy, the CDM reads it for every license
+// and usage check. Timed in batches, a call takes less than reading the
+// time around it.
+void Clocks(const Options& options)
+{
+    static constexpr uint32_t Batch = 100;
+
+    typedef CDMi::HostImplementation::ClockPolicy ClockPolicy;
+
+    static const struct {
+        ClockPolicy policy;
+        const char* name;
+    } policies[] = {
+        { ClockPolicy::FORWARD, "clock now, forward" },
+        { ClockPolicy::MONOTONIC, "clock now, monotonic" },
+        { ClockPolicy::WALLCLOCK, "clock now, wallclock" }
+    };
+
+    const uint32_t rounds = std::max<uint32_t>(options.iterations / Batch, 1);
+    std::vector<uint64_t> latencies;
+    latencies.reserve(rounds * Batch);
+
+    for (const auto& entry : policies) {
+        CDMi::HostImplementation host;
+        host.Clock(entry.policy);
+
+        latencies.clear();
+        const uint64_t begin = Test::Now();
+
+        for (uint32_t round = 0; round < rounds; round++) {
+            const uint64_t start = Test::Now();
+            for (uint32_t index = 0; index < Batch; index++) {
+                host.now();
+            }
+            latencies.insert(latencies.end(), Batch, (Test::Now() - start) / Batch);
+        }
+
+        Report(entry.name, latencies, Test::Now() - begin);
+    }
+}
+
+class Listener : public widevine::Cdm::IEventListener {
+public:
+    void onMessage(const std::string&, widevine::Cdm::MessageType, const std::string&) override {}
+    void onKeyStatusesChange(const std::string&, bool) override {}
+    void onRemoveComplete(const std::string&) override {}
+    void onDeferredComplete(const std::string&, widevine::Cdm::Status) override {}
+    void onDirectIndividualizationRequest(const std::string&, const std::string&) override {}
+};
+
+// From opening the storage location to a usable persistent license: cold,
+// on an empty store, the license is requested and installed; warm, after a
+// restart, it is loaded from the store. The stub needs no provisioning, in
+// the field a cold store pays for that as well. Run it last: the stub only
+// keeps track of its latest Cdm instance (see Stub::Renew).
+void Startup(const Options& options)
+{
+    const Test::Key key(Test::MakeKey(0));
+    const std::string initData(Test::Pssh({ key }));
+    const std::string license(Test::License({ key }));
+    const uint32_t rounds = std::min<uint32_t>(options.iterations, 100);
+    widevine::Cdm::ClientInfo client;
+    Listener listener;
+    std::vector<uint64_t> cold;
+    std::vector<uint64_t> warm;
+    uint64_t coldElapsed = 0;
+    uint64_t warmElapsed = 0;
+
+    char directory[] = "/tmp/widevine-startup-XXXXXX";
+    if (::mkdtemp(directory) == nullptr) {
+        return;
+    }
+
+    cold.reserve(rounds);
+    warm.reserve(rounds);
+
+    for (uint32_t round = 0; round < rounds; round++) {
+        std::string sessionId;
+
+        for (const bool stored : { false, true }) {
+            const uint64_t start = Test::Now();
+
+            CDMi::HostImplementation host;
+            host.Open(directory);
+            widevine::Cdm::initialize(widevine::Cdm::kNoSecureOutput, client, &host, &host, &host, widevine::Cdm::kErrors);
+            std::unique_ptr<widevine::Cdm> cdm(widevine::Cdm::create(&listener, &host, false));
+
+            if (stored == false) {
+                cdm->createSession(widevine::Cdm::kPersistentLicense, &sessionId);
+                cdm->generateRequest(sessionId, widevine::Cdm::kCenc, initData);
+                cdm->update(sessionId, license);
+            } else {
+                cdm->load(sessionId);
+            }
+
+            const uint64_t elapsed = Test::Now() - start;
+            (stored == true ? warm : cold).push_back(elapsed);
+            (stored == true ? warmElapsed : coldElapsed) += elapsed;
+
+            if (stored == true) {
+                // Empty again, for the next cold start.
+                cdm->remove(sessionId);
+            }
+        }
+    }
+
+    Report("first license, cold store", cold, coldElapsed);
+    Report("first license, warm store", warm, warmElapsed);
+
+    ::rmdir(directory);
+}
+
+class TimerClient : public widevine::Cdm::ITimer::IClient {
+public:
+    void onTimerExpired(void*) override {}
+};
+
+// A CDM timer as HostImplementation queued it on a Core::TimerType, before
+// the timer wheel.
+class QueuedTimer {
+public:
+    QueuedTimer(TimerClient* client, void* context)
+        : _client(client)
+        , _context(context)
+    {
+    }
+
+    bool operator==(const QueuedTimer& other) const
+    {
+        return ((_client == other._client) && (_context == other._context));
+    }
+    uint64_t Timed(const uint64_t)
+    {
+        _client->onTimerExpired(_context);
+        return (0);
+    }
+
+private:
+    TimerClient* _client;
+    void* _context;
+};
+
+void* Context(const uint32_t index)
+{
+    return (reinterpret_cast<void*>(static_cast<uintptr_t>(index + 1)));
+}
+
+// Scheduling and revoking a timer while others are outstanding, on the
+// timer wheel and on the Core::TimerType it replaced. The outstanding
+// timers are an hour out, so none fires meanwhile.
+void Timers(const Options& options)
+{
+    static constexpr uint64_t Far = 60 * 60 * 1000; // ms
+
+    // A time ordered list walks its timers, keep the rounds affordable.
+    const uint32_t rounds = std::min<uint32_t>(options.iterations, 250);
+    TimerClient client;
+    std::vector<uint64_t> latencies;
+    char scenario[32];
+
+    latencies.reserve(rounds);
+
+    for (const uint32_t outstanding : { 10, 1000, 100000 }) {
+        {
+            CDMi::TimerWheel wheel(10);
+
+            for (uint32_t index = 0; index < outstanding; index++) {
+                wheel.Schedule(Far + index, &client, Context(index));
+            }
+
+            latencies.clear();
+            const uint64_t begin = Test::Now();
+
+            for (uint32_t round = 0; round < rounds; round++) {
+                const uint64_t start = Test::Now();
+                wheel.Schedule(Far + ((round * 7919) % outstanding), &client, Context(outstanding + round));
+                wheel.Revoke(&client, Context(outstanding + round));
+                latencies.push_back(Test::Now() - start);
+            }
+
+            ::snprintf(scenario, sizeof(scenario), "timer wheel, %u timers", outstanding);
+            Report(scenario, latencies, Test::Now() - begin);
+
+            wheel.Revoke(&client);
+        }
+        {
+            Thunder::Core::TimerType<QueuedTimer> queue(Thunder::Core::Thread::DefaultStackSize(), _T("benchmark"));
+            const uint64_t now = Thunder::Core::Time::Now().Ticks();
+            const auto due = [now](const uint64_t delay) { return (now + (delay * Thunder::Core::Time::TicksPerMillisecond)); };
+
+            // Latest first, so filling does not walk the list.
+            for (uint32_t index = outstanding; index > 0; index--) {
+                queue.Schedule(due(Far + index - 1), QueuedTimer(&client, Context(index - 1)));
+            }
+
+            latencies.clear();
+            const uint64_t begin = Test::Now();
+
+            for (uint32_t round = 0; round < rounds; round++) {
+                const QueuedTimer timer(&client, Context(outstanding + round));
+                const uint64_t start = Test::Now();
+                queue.Schedule(due(Far + ((round * 7919) % outstanding)), timer);
+                queue.Revoke(timer);
+                latencies.push_back(Test::Now() - start);
+            }
+
+            ::snprintf(scenario, sizeof(scenario), "core timer, %u timers", outstanding);
+            Report(scenario, latencies, Test::Now() - begin);
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    options.sessions = (argc > 1 ? static_cast<uint32_t>(::atoi(argv[1])) : 16);
+    options.iterations = (argc > 2 ? static_cast<uint32_t>(::atoi(argv[2])) : 10000);
+    options.sampleSize = (argc > 3 ? static_cast<uint32_t>(::atoi(argv[3])) : 16 * 1024);
+
+    if ((options.sessions == 0) || (options.sessions > 256)) {
+        ::fprintf(stderr, "sessions must be within 1..256\n");
+        return (1);
+    }
+
+    ::printf("%u sessions, %u iterations, %u byte samples\n", options.sessions, options.iterations, options.sampleSize);
+
+    CDMi::IMediaKeys* system = Test::System("{}");
+
+    std::vector<CDMi::IMediaKeySession*> sessions;
+    std::vector<Test::Callback*> callbacks;
+
+    const bool result = Sessions(system, options, sessions, callbacks);
+
+    if (result == true) {
+        Renewals(options, sessions, callbacks);
+        Decrypts(options, sessions, CDMi::AesCtr_Cenc, "decrypt cenc");
+        Decrypts(options, sessions, CDMi::AesCbc_Cbc1, "decrypt cbc1");
+        // Clear lead samples, for the cost saved against the above.
+        Decrypts(options, sessions, CDMi::Clear, "decrypt clear");
+        Batches(options, sessions);
+        Scaling(options, sessions);
+        Engine(options);
+        Storage(options);
+        Clocks(options);
+        Sharing(system, options, sessions);
+        Timers(options);
+        Startup(options);
+    }
+
+    for (CDMi::IMediaKeySession* session : sessions) {
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+    for (Test::Callback* callback : callbacks) {
+        delete callback;
+    }
+
+    return (result == true ? 0 : 1);
+}
@@ -0,0 +1,81 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Clear lead samples: handed back as they are before any key arrived,
+// without going to the CDM, while encrypted samples still need the key.
+
+#include "Helpers.h"
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":0}");
+    EXPECT(system != nullptr);
+
+    const Test::Key key(Test::MakeKey(2));
+    const std::string initData(Test::Pssh({ key }));
+    CDMi::IMediaKeySession* session = nullptr;
+
+    EXPECT(system->CreateMediaKeySession("com.widevine.alpha", CDMi::Temporary, "cenc",
+               reinterpret_cast<const uint8_t*>(initData.data()), static_cast<uint32_t>(initData.size()),
+               nullptr, 0, &session) == CDMi::CDMi_SUCCESS);
+
+    if (session != nullptr) {
+        Test::Callback callback;
+        session->Run(&callback);
+        EXPECT(callback.WaitForMessages(1) == true);
+
+        static constexpr uint32_t Size = 256;
+        const CDMi::EncryptionPattern pattern = { 0, 0 };
+        uint8_t iv[16] = { 5 };
+        uint8_t clear[Size];
+        uint8_t sample[Size];
+        Test::Fill(clear, Size, 8);
+        ::memcpy(sample, clear, Size);
+
+        const uint32_t calls = Stub::DecryptCalls();
+        uint8_t* output = nullptr;
+
+        // No license yet.
+        EXPECT(Test::Decrypt(session, CDMi::Clear, pattern, key, iv, sample, Size, &output) == CDMi::CDMi_SUCCESS);
+        EXPECT(output == sample);
+        EXPECT(::memcmp(sample, clear, Size) == 0);
+        EXPECT(session->ReleaseClearContent(nullptr, 0, Size, output) == CDMi::CDMi_SUCCESS);
+
+        // Nor is the key needed for it.
+        EXPECT(Test::Decrypt(session, CDMi::Clear, pattern, Test::MakeKey(9), iv, sample, Size) == CDMi::CDMi_SUCCESS);
+        EXPECT(::memcmp(sample, clear, Size) == 0);
+        EXPECT(Stub::DecryptCalls() == calls);
+
+        Test::Encrypt(CDMi::AesCtr_Cenc, pattern, key, iv, sample, Size);
+        EXPECT(Test::Decrypt(session, CDMi::AesCtr_Cenc, pattern, key, iv, sample, Size) == CDMi::CDMi_S_FALSE);
+
+        const std::string license(Test::License({ key }));
+        session->Update(reinterpret_cast<const uint8_t*>(license.data()), static_cast<uint32_t>(license.size()));
+        EXPECT(callback.WaitForUpdates(1) == true);
+
+        EXPECT(Test::Decrypt(session, CDMi::AesCtr_Cenc, pattern, key, iv, sample, Size) == CDMi::CDMi_SUCCESS);
+        EXPECT(::memcmp(sample, clear, Size) == 0);
+        EXPECT(Stub::DecryptCalls() > calls);
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
@@ -0,0 +1,98 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The clock the CDM sees when the wall clock jumps, as it does on the first
+// NTP sync after the plugin was loaded.
+
+#include "Helpers.h"
+
+#include <HostImplementation.h>
+
+#include <atomic>
+#include <thread>
+
+namespace {
+
+static constexpr int64_t Hour = 60 * 60 * 1000; // ms
+static constexpr int64_t Tolerance = 500; // ms
+
+class Host : public CDMi::HostImplementation {
+public:
+    Host()
+        : CDMi::HostImplementation()
+        , _skew(0)
+    {
+    }
+
+    void Jump(const int64_t skew) { _skew = skew; }
+
+protected:
+    int64_t WallClock() const override
+    {
+        return (CDMi::HostImplementation::WallClock() + _skew);
+    }
+
+private:
+    std::atomic<int64_t> _skew;
+};
+
+int64_t Real()
+{
+    return (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+bool Near(const int64_t value, const int64_t expected)
+{
+    return ((value > (expected - Tolerance)) && (value < (expected + Tolerance)));
+}
+
+} // namespace
+
+int main()
+{
+    {
+        // The default follows the sync forward, but never goes back.
+        Host host;
+        host.Jump(Hour);
+        const int64_t synced = host.now();
+        EXPECT(Near(synced, Real() + Hour));
+
+        host.Jump(0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+        const int64_t later = host.now();
+        EXPECT(later >= synced);
+        EXPECT(Near(later, Real() + Hour));
+    }
+    {
+        Host host;
+        host.Clock(CDMi::HostImplementation::ClockPolicy::MONOTONIC);
+        host.Jump(Hour);
+        EXPECT(Near(host.now(), Real()));
+    }
+    {
+        Host host;
+        host.Clock(CDMi::HostImplementation::ClockPolicy::WALLCLOCK);
+        host.Jump(Hour);
+        EXPECT(Near(host.now(), Real() + Hour));
+        host.Jump(-Hour);
+        EXPECT(Near(host.now(), Real() - Hour));
+    }
+
+    return (Test::Result());
+}
@@ -0,0 +1,117 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sessions decrypting on their own threads while licenses are renewed and
+// sessions come and go, every sample must decrypt correctly.
+
+#include "Helpers.h"
+
+#include <atomic>
+#include <thread>
+
+namespace {
+
+constexpr uint32_t Sessions = 4;
+constexpr uint32_t SampleSize = 4096;
+constexpr uint32_t Iterations = 2000;
+
+void Decrypts(CDMi::IMediaKeySession* session, const Test::Key& key, std::atomic<uint32_t>& failures)
+{
+    static const CDMi::EncryptionPattern none = { 0, 0 };
+
+    std::vector<uint8_t> clear(SampleSize);
+    std::vector<uint8_t> sample(SampleSize);
+    uint8_t iv[16];
+
+    for (uint32_t index = 0; index < Iterations; index++) {
+        ::memset(iv, 0, sizeof(iv));
+        iv[7] = static_cast<uint8_t>(index);
+
+        Test::Fill(clear.data(), SampleSize, index);
+        sample = clear;
+        Test::Encrypt(CDMi::AesCtr_Cenc, none, key, iv, sample.data(), SampleSize);
+
+        if ((Test::Decrypt(session, CDMi::AesCtr_Cenc, none, key, iv, sample.data(), SampleSize) != CDMi::CDMi_SUCCESS) || (sample != clear)) {
+            failures++;
+        }
+    }
+}
+
+} // namespace
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{}");
+
+    Test::Callback callbacks[Sessions];
+    CDMi::IMediaKeySession* sessions[Sessions];
+    std::vector<Test::Key> keys;
+
+    for (uint32_t index = 0; index < Sessions; index++) {
+        keys.push_back(Test::MakeKey(static_cast<uint8_t>(index * 16)));
+        sessions[index] = Test::Open(system, callbacks[index], { keys[index] });
+        EXPECT(sessions[index] != nullptr);
+        if (sessions[index] == nullptr) {
+            return (Test::Result());
+        }
+    }
+
+    std::atomic<uint32_t> failures(0);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+
+    for (uint32_t index = 0; index < Sessions; index++) {
+        threads.emplace_back(Decrypts, sessions[index], keys[index], std::ref(failures));
+    }
+
+    // Renewals and short lived sessions exercise the CDM guard meanwhile.
+    std::thread churn([&]() {
+        uint8_t seed = 200;
+
+        while (done.load() == false) {
+            for (uint32_t index = 0; index < Sessions; index++) {
+                const std::string license(Test::License({ keys[index] }));
+                sessions[index]->Update(reinterpret_cast<const uint8_t*>(license.data()), static_cast<uint32_t>(license.size()));
+            }
+
+            Test::Callback callback;
+            CDMi::IMediaKeySession* session = Test::Open(system, callback, { Test::MakeKey(seed++) });
+            if (session != nullptr) {
+                session->Close();
+                system->DestroyMediaKeySession(session);
+            }
+        }
+    });
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    done = true;
+    churn.join();
+
+    EXPECT(failures.load() == 0);
+    EXPECT(Stub::DecryptThreads() >= Sessions);
+
+    for (uint32_t index = 0; index < Sessions; index++) {
+        EXPECT(sessions[index]->Close() == CDMi::CDMi_SUCCESS);
+        EXPECT(system->DestroyMediaKeySession(sessions[index]) == CDMi::CDMi_SUCCESS);
+    }
+
+    return (Test::Result());
+}
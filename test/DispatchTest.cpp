@@ -0,0 +1,108 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// CDM events piling up behind an application callback that does not
+// return: the CDM keeps posting without blocking, well beyond the queue
+// capacity, and every event is delivered once the callback returns.
+
+#include "Helpers.h"
+
+#include <atomic>
+#include <thread>
+
+namespace {
+
+static constexpr uint32_t Renewals = 600; // beyond the 256 events capacity
+
+class Blocking : public Test::Callback {
+public:
+    Blocking()
+        : Test::Callback()
+        , _lock()
+        , _released()
+        , _blocked(true)
+    {
+    }
+
+    void OnKeyMessage(const uint8_t* data, uint32_t length, const char* url) override
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _released.wait(lock, [this]() { return (_blocked == false); });
+        lock.unlock();
+
+        Test::Callback::OnKeyMessage(data, length, url);
+    }
+
+    void Release()
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _blocked = false;
+        _released.notify_all();
+    }
+
+private:
+    std::mutex _lock;
+    std::condition_variable _released;
+    bool _blocked;
+};
+
+} // namespace
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":0}");
+    EXPECT(system != nullptr);
+
+    const Test::Key key(Test::MakeKey(6));
+    Test::Callback setup;
+    CDMi::IMediaKeySession* session = Test::Open(system, setup, { key });
+    EXPECT(session != nullptr);
+
+    if (session != nullptr) {
+        // Attaching again requests a license again, its delivery blocks.
+        Blocking callback;
+        session->Run(&callback);
+
+        const std::string sessionId(session->GetSessionId());
+        std::atomic<bool> done(false);
+        std::thread renewer([&sessionId, &done]() {
+            for (uint32_t index = 0; index < Renewals; index++) {
+                Stub::Renew(sessionId);
+            }
+            done = true;
+        });
+
+        const uint64_t deadline = Test::Now() + 2000000;
+        while ((done == false) && (Test::Now() < deadline)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT(done == true);
+
+        callback.Release();
+        renewer.join();
+
+        EXPECT(callback.WaitForMessages(1 + Renewals) == true);
+        EXPECT(callback.Messages() == (1 + Renewals));
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
@@ -0,0 +1,289 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// Shared by the tests and the benchmark: they run the plugin against the
+// stub widevine::Cdm, one executable per area, the exit code is the
+// number of failed expectations.
+
+#include "stub/StubCdm.h"
+
+#include <cdmi.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define EXPECT(condition) Test::Expect((condition), #condition, __FILE__, __LINE__)
+
+namespace Test {
+
+static uint32_t g_failures = 0;
+
+inline bool Expect(const bool condition, const char* text, const char* file, const int line)
+{
+    if (condition == false) {
+        ::fprintf(stderr, "%s:%d: expected %s\n", file, line, text);
+        g_failures++;
+    }
+    return (condition);
+}
+
+inline int Result()
+{
+    ::fprintf(stderr, "%u failure(s)\n", g_failures);
+    return (g_failures == 0 ? 0 : 1);
+}
+
+// Microseconds on the monotonic clock.
+inline uint64_t Now()
+{
+    return (static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()));
+}
+
+struct Key {
+    uint8_t id[Stub::KeySize];
+    uint8_t value[Stub::KeySize];
+};
+
+inline Key MakeKey(const uint8_t seed)
+{
+    Key result;
+    for (uint8_t index = 0; index < Stub::KeySize; index++) {
+        result.id[index] = static_cast<uint8_t>(seed + index);
+        result.value[index] = static_cast<uint8_t>((seed * 31) + (index * 7) + 1);
+    }
+    return (result);
+}
+
+inline std::string License(const std::vector<Key>& keys)
+{
+    std::string result;
+    for (const Key& key : keys) {
+        result += Stub::License(key.id, key.value);
+    }
+    return (result);
+}
+
+// A version 1 Widevine PSSH box listing the key ids.
+inline std::string Pssh(const std::vector<Key>& keys)
+{
+    static const uint8_t systemId[] = { 0xed, 0xef, 0x8b, 0xa9, 0x79, 0xd6, 0x4a, 0xce, 0xa3, 0xc8, 0x27, 0xdc, 0xd5, 0x1d, 0x21, 0xed };
+
+    std::string box;
+    const uint32_t size = 8 + 4 + 16 + 4 + static_cast<uint32_t>(keys.size() * 16) + 4;
+    const auto be32 = [&box](const uint32_t value) {
+        box += static_cast<char>(value >> 24);
+        box += static_cast<char>(value >> 16);
+        box += static_cast<char>(value >> 8);
+        box += static_cast<char>(value);
+    };
+
+    be32(size);
+    box += "pssh";
+    be32(0x01000000);
+    box.append(reinterpret_cast<const char*>(systemId), sizeof(systemId));
+    be32(static_cast<uint32_t>(keys.size()));
+    for (const Key& key : keys) {
+        box.append(reinterpret_cast<const char*>(key.id), sizeof(key.id));
+    }
+    be32(0);
+    return (box);
+}
+
+inline widevine::Cdm::EncryptionScheme Scheme(const CDMi::EncryptionScheme scheme)
+{
+    return ((scheme == CDMi::AesCtr_Cenc) || (scheme == CDMi::AesCtr_Cens) ? widevine::Cdm::kAesCtr : widevine::Cdm::kAesCbc);
+}
+
+inline void Encrypt(const CDMi::EncryptionScheme scheme, const CDMi::EncryptionPattern& pattern, const Key& key, const uint8_t iv[16], uint8_t* data, const uint32_t length)
+{
+    widevine::Cdm::Pattern cdmPattern;
+    cdmPattern.encrypted_blocks = pattern.encrypted_blocks;
+    cdmPattern.clear_blocks = pattern.clear_blocks;
+    Stub::Encrypt(Scheme(scheme), cdmPattern, key.value, iv, data, length);
+}
+
+inline void Fill(uint8_t* data, const uint32_t length, const uint32_t seed)
+{
+    uint32_t state = seed * 2654435761u + 1;
+    for (uint32_t index = 0; index < length; index++) {
+        state = (state * 1103515245u) + 12345u;
+        data[index] = static_cast<uint8_t>(state >> 16);
+    }
+}
+
+// The plugin as the OCDM server sees it, initialized with the config.
+inline CDMi::IMediaKeys* System(const std::string& config)
+{
+    CDMi::ISystemFactory* factory = GetSystemFactory();
+    factory->Initialize(nullptr, config);
+    return (factory->Instance());
+}
+
+// Records what the plugin reports to the application.
+class Callback : public CDMi::IMediaKeySessionCallback {
+public:
+    Callback(const Callback&) = delete;
+    Callback& operator=(const Callback&) = delete;
+
+    Callback()
+        : _lock()
+        , _changed()
+        , _messages(0)
+        , _message()
+        , _messageData(nullptr)
+        , _usable(0)
+        , _updates(0)
+        , _errors(0)
+    {
+    }
+    ~Callback() override = default;
+
+public:
+    void OnKeyMessage(const uint8_t* data, uint32_t length, const char*) override
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _message.assign(reinterpret_cast<const char*>(data), length);
+        _messageData = data;
+        _messages++;
+        _changed.notify_all();
+    }
+    void OnError(int16_t, CDMi::CDMi_RESULT, const char*) override
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _errors++;
+        _changed.notify_all();
+    }
+    void OnKeyStatusUpdate(const char* status, const uint8_t*, const uint8_t) override
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        if (::strcmp(status, "KeyUsable") == 0) {
+            _usable++;
+        }
+    }
+    void OnKeyStatusesUpdated() const override
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _updates++;
+        _changed.notify_all();
+    }
+
+    uint32_t Messages() const
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        return (_messages);
+    }
+    std::string Message() const
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        return (_message);
+    }
+    const uint8_t* MessageData() const
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        return (_messageData);
+    }
+    uint32_t Usable() const
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        return (_usable);
+    }
+    uint32_t Updates() const
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        return (_updates);
+    }
+    uint32_t Errors() const
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        return (_errors);
+    }
+
+    bool WaitForMessages(const uint32_t count, const uint32_t timeout = 2000) const
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        return (_changed.wait_for(lock, std::chrono::milliseconds(timeout), [this, count]() { return (_messages >= count); }));
+    }
+    bool WaitForUpdates(const uint32_t count, const uint32_t timeout = 2000) const
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        return (_changed.wait_for(lock, std::chrono::milliseconds(timeout), [this, count]() { return (_updates >= count); }));
+    }
+
+private:
+    mutable std::mutex _lock;
+    mutable std::condition_variable _changed;
+    uint32_t _messages;
+    std::string _message;
+    const uint8_t* _messageData;
+    uint32_t _usable;
+    mutable uint32_t _updates;
+    uint32_t _errors;
+};
+
+// A session with a license for the keys, as an application would get it:
+// create, attach, answer the license request.
+inline CDMi::IMediaKeySession* Open(CDMi::IMediaKeys* system, Callback& callback, const std::vector<Key>& keys, const int32_t licenseType = CDMi::Temporary)
+{
+    CDMi::IMediaKeySession* session = nullptr;
+    const std::string initData(Pssh(keys));
+
+    if (system->CreateMediaKeySession("com.widevine.alpha", licenseType, "cenc",
+            reinterpret_cast<const uint8_t*>(initData.data()), static_cast<uint32_t>(initData.size()),
+            nullptr, 0, &session) != CDMi::CDMi_SUCCESS) {
+        return (nullptr);
+    }
+
+    const uint32_t updates = callback.Updates();
+    session->Run(&callback);
+
+    if (callback.WaitForMessages(1) == true) {
+        const std::string license(License(keys));
+        session->Update(reinterpret_cast<const uint8_t*>(license.data()), static_cast<uint32_t>(license.size()));
+        callback.WaitForUpdates(updates + 1);
+    }
+    return (session);
+}
+
+inline CDMi::CDMi_RESULT Decrypt(CDMi::IMediaKeySession* session, const CDMi::EncryptionScheme scheme, const CDMi::EncryptionPattern& pattern,
+    const Key& key, const uint8_t iv[16], uint8_t* data, const uint32_t length, uint8_t** output = nullptr)
+{
+    uint32_t clearLength = 0;
+    uint8_t* clear = nullptr;
+
+    const CDMi::CDMi_RESULT result = session->Decrypt(nullptr, 0, scheme, pattern, iv, 16, data, length,
+        &clearLength, &clear, sizeof(key.id), key.id, false);
+
+    if (output != nullptr) {
+        *output = clear;
+    } else if ((result == CDMi::CDMi_SUCCESS) && (clear != data)) {
+        ::memcpy(data, clear, length);
+        session->ReleaseClearContent(nullptr, 0, clearLength, clear);
+    }
+    return (result);
+}
+
+} // namespace Test
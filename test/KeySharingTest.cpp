@@ -0,0 +1,185 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Key sharing: a session for init data whose keys another live session of
+// the same license type already holds usable gets them without a license
+// request of its own, until the donor goes away or its keys expire.
+
+#include "Helpers.h"
+
+#include <thread>
+
+namespace {
+
+CDMi::IMediaKeySession* Create(CDMi::IMediaKeys* system, const std::vector<Test::Key>& keys, Test::Callback& callback, const int32_t licenseType = CDMi::Temporary)
+{
+    CDMi::IMediaKeySession* session = nullptr;
+    const std::string initData(Test::Pssh(keys));
+
+    if (system->CreateMediaKeySession("com.widevine.alpha", licenseType, "cenc",
+            reinterpret_cast<const uint8_t*>(initData.data()), static_cast<uint32_t>(initData.size()),
+            nullptr, 0, &session) == CDMi::CDMi_SUCCESS) {
+        session->Run(&callback);
+    }
+    return (session);
+}
+
+bool Decrypts(CDMi::IMediaKeySession* session, const Test::Key& key)
+{
+    static constexpr uint32_t Size = 256;
+    const CDMi::EncryptionPattern pattern = { 0, 0 };
+    uint8_t iv[16] = { 9 };
+    uint8_t clear[Size];
+    uint8_t sample[Size];
+    Test::Fill(clear, Size, 2);
+    ::memcpy(sample, clear, Size);
+    Test::Encrypt(CDMi::AesCtr_Cenc, pattern, key, iv, sample, Size);
+
+    return ((Test::Decrypt(session, CDMi::AesCtr_Cenc, pattern, key, iv, sample, Size) == CDMi::CDMi_SUCCESS) && (::memcmp(sample, clear, Size) == 0));
+}
+
+// The session shares the keys of a donor that is about to be lost.
+CDMi::IMediaKeySession* Sharer(CDMi::IMediaKeys* system, const Test::Key& key, Test::Callback& callback)
+{
+    CDMi::IMediaKeySession* session = Create(system, { key }, callback);
+    EXPECT(session != nullptr);
+    EXPECT(callback.WaitForUpdates(1) == true);
+    EXPECT(callback.Messages() == 0);
+    EXPECT(callback.Usable() == 1);
+    return (session);
+}
+
+// Having lost the donor, the session requests a license of its own.
+void Fallback(CDMi::IMediaKeySession* session, const Test::Key& key, Test::Callback& callback)
+{
+    EXPECT(callback.WaitForMessages(1) == true);
+    EXPECT(callback.Updates() == 2);
+
+    const std::string license(Test::License({ key }));
+    session->Update(reinterpret_cast<const uint8_t*>(license.data()), static_cast<uint32_t>(license.size()));
+    EXPECT(callback.WaitForUpdates(3) == true);
+    EXPECT(callback.Usable() == 2);
+    EXPECT(Decrypts(session, key) == true);
+}
+
+} // namespace
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":0}");
+    EXPECT(system != nullptr);
+
+    const Test::Key key(Test::MakeKey(11));
+    const Test::Key unknown(Test::MakeKey(12));
+
+    Test::Callback donorCallback;
+    CDMi::IMediaKeySession* donor = Test::Open(system, donorCallback, { key });
+    EXPECT((donor != nullptr) && (donorCallback.Usable() == 1));
+
+    // The donor is indexed in the background, after its key status update.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    {
+        Test::Callback callback;
+        CDMi::IMediaKeySession* session = Create(system, { key }, callback);
+        EXPECT(session != nullptr);
+
+        EXPECT(callback.WaitForUpdates(1) == true);
+        EXPECT(callback.Messages() == 0);
+        EXPECT(callback.Usable() == 1);
+
+        EXPECT(Decrypts(session, key) == true);
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    {
+        // Not all keys are held, a license is needed.
+        Test::Callback callback;
+        CDMi::IMediaKeySession* session = Create(system, { key, unknown }, callback);
+        EXPECT(session != nullptr);
+        EXPECT(callback.WaitForMessages(1) == true);
+        EXPECT(callback.Usable() == 0);
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    {
+        // Only sessions of the same license type share.
+        Test::Callback callback;
+        CDMi::IMediaKeySession* session = Create(system, { key }, callback, CDMi::PersistentLicense);
+        EXPECT(session != nullptr);
+        EXPECT(callback.WaitForMessages(1) == true);
+        EXPECT(callback.Usable() == 0);
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    {
+        // The donor is destroyed after the share.
+        Test::Callback callback;
+        CDMi::IMediaKeySession* session = Sharer(system, key, callback);
+
+        donor->Close();
+        system->DestroyMediaKeySession(donor);
+
+        Fallback(session, key, callback);
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    {
+        // The keys of the donor expire after the share.
+        const Test::Key expiring(Test::MakeKey(13));
+        Test::Callback expiringCallback;
+        CDMi::IMediaKeySession* expired = Test::Open(system, expiringCallback, { expiring });
+        EXPECT(expired != nullptr);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        Test::Callback callback;
+        CDMi::IMediaKeySession* session = Sharer(system, expiring, callback);
+
+        Stub::Expire(expired->GetSessionId(), expiring.id);
+
+        Fallback(session, expiring, callback);
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+        expired->Close();
+        system->DestroyMediaKeySession(expired);
+    }
+
+    {
+        // The donor is gone.
+        Test::Callback callback;
+        CDMi::IMediaKeySession* session = Create(system, { key }, callback);
+        EXPECT(session != nullptr);
+        EXPECT(callback.WaitForMessages(1) == true);
+        EXPECT(callback.Usable() == 0);
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
@@ -0,0 +1,164 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Key status reporting: the application hears only about the keys whose
+// status changed, and a burst of CDM key status events reaches it as one
+// OnKeyStatusesUpdated.
+
+#include "Helpers.h"
+
+#include <thread>
+#include <utility>
+
+namespace {
+
+// Records every reported key status and can hold the dispatch thread in
+// OnKeyMessage, so the events posted meanwhile stay queued.
+class Recorder : public Test::Callback {
+public:
+    Recorder()
+        : Test::Callback()
+        , _lock()
+        , _released()
+        , _entered()
+        , _held(false)
+        , _waiting(false)
+        , _reported()
+    {
+    }
+
+    void OnKeyMessage(const uint8_t* data, uint32_t length, const char* url) override
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _waiting = _held;
+        _entered.notify_all();
+        _released.wait(lock, [this]() { return (_held == false); });
+        _waiting = false;
+        lock.unlock();
+
+        Test::Callback::OnKeyMessage(data, length, url);
+    }
+    void OnKeyStatusUpdate(const char* status, const uint8_t* keyId, const uint8_t length) override
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _reported.emplace_back(std::string(status), std::string(reinterpret_cast<const char*>(keyId), length));
+        lock.unlock();
+
+        Test::Callback::OnKeyStatusUpdate(status, keyId, length);
+    }
+
+    void Hold(const bool held)
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _held = held;
+        _released.notify_all();
+    }
+    bool WaitForHeld(const uint32_t timeout = 2000)
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        return (_entered.wait_for(lock, std::chrono::milliseconds(timeout), [this]() { return (_waiting == true); }));
+    }
+
+    // What was reported since the previous call.
+    std::vector<std::pair<std::string, std::string>> Reported()
+    {
+        std::vector<std::pair<std::string, std::string>> result;
+        std::unique_lock<std::mutex> lock(_lock);
+        result.swap(_reported);
+        return (result);
+    }
+
+private:
+    std::mutex _lock;
+    std::condition_variable _released;
+    std::condition_variable _entered;
+    bool _held;
+    bool _waiting;
+    std::vector<std::pair<std::string, std::string>> _reported;
+};
+
+std::string Id(const Test::Key& key)
+{
+    return (std::string(reinterpret_cast<const char*>(key.id), sizeof(key.id)));
+}
+
+} // namespace
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":0}");
+    EXPECT(system != nullptr);
+
+    const std::vector<Test::Key> keys({ Test::MakeKey(1), Test::MakeKey(2), Test::MakeKey(3) });
+    Recorder callback;
+    CDMi::IMediaKeySession* session = Test::Open(system, callback, keys);
+    EXPECT(session != nullptr);
+
+    if (session != nullptr) {
+        const std::string sessionId(session->GetSessionId());
+
+        // The license reports each of its keys once, the CDM's own key
+        // status event for it adds nothing.
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::vector<std::pair<std::string, std::string>> reported(callback.Reported());
+        EXPECT(reported.size() == keys.size());
+        for (const std::pair<std::string, std::string>& entry : reported) {
+            EXPECT(entry.first == "KeyUsable");
+        }
+        EXPECT(callback.Updates() == 1);
+
+        // One key expires: only that key is reported.
+        Stub::Expire(sessionId, keys[1].id);
+        EXPECT(callback.WaitForUpdates(2) == true);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        reported = callback.Reported();
+        EXPECT(reported.size() == 1);
+        if (reported.size() == 1) {
+            EXPECT(reported[0].first == "KeyExpired");
+            EXPECT(reported[0].second == Id(keys[1]));
+        }
+        EXPECT(callback.Updates() == 2);
+
+        // A burst while the dispatch thread is busy: the first change is
+        // held back, the others join it, the application is told once.
+        callback.Hold(true);
+        Stub::Renew(sessionId);
+        EXPECT(callback.WaitForHeld() == true);
+        Stub::Expire(sessionId, keys[0].id);
+        Stub::Expire(sessionId, keys[2].id);
+        Stub::Expire(sessionId, keys[0].id);
+        Stub::Expire(sessionId, keys[2].id);
+        callback.Hold(false);
+
+        EXPECT(callback.WaitForUpdates(3) == true);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        reported = callback.Reported();
+        EXPECT(reported.size() == 2);
+        for (const std::pair<std::string, std::string>& entry : reported) {
+            EXPECT(entry.first == "KeyExpired");
+            EXPECT((entry.second == Id(keys[0])) || (entry.second == Id(keys[2])));
+        }
+        EXPECT(callback.Updates() == 3);
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
@@ -0,0 +1,121 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The license message path: from the CDM listener through the event
+// dispatcher to the application, a renewal neither allocates on the CDM
+// thread nor per message on the way.
+
+#include "Allocations.h"
+#include "Helpers.h"
+
+#include <Extensions.h>
+
+namespace {
+
+// Holds the messages back on request, so the renewals posted meanwhile
+// each take an event of their own.
+class Gated : public Test::Callback {
+public:
+    Gated()
+        : Test::Callback()
+        , _lock()
+        , _released()
+        , _held(false)
+    {
+    }
+
+    void OnKeyMessage(const uint8_t* data, uint32_t length, const char* url) override
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _released.wait(lock, [this]() { return (_held == false); });
+        lock.unlock();
+
+        Test::Callback::OnKeyMessage(data, length, url);
+    }
+
+    void Hold(const bool held)
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _held = held;
+        _released.notify_all();
+    }
+
+private:
+    std::mutex _lock;
+    std::condition_variable _released;
+    bool _held;
+};
+
+} // namespace
+
+int main()
+{
+    static constexpr uint32_t Renewals = 100;
+    // Posting the next message may take an event while the dispatch thread
+    // still returns the previous one, more are never in use here.
+    static constexpr uint32_t InFlight = 4;
+
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":0}");
+    EXPECT(system != nullptr);
+
+    const Test::Key key(Test::MakeKey(1));
+    Test::Callback setup;
+    CDMi::IMediaKeySession* session = Test::Open(system, setup, { key });
+    EXPECT(session != nullptr);
+
+    if (session != nullptr) {
+        const std::string sessionId(session->GetSessionId());
+        Gated callback;
+        session->Run(&callback);
+        EXPECT(callback.WaitForMessages(1) == true);
+
+        // Service certificate and key rotation messages run into the tens of KB.
+        std::string renewal(32 * 1024, '\0');
+        Test::Fill(reinterpret_cast<uint8_t*>(&renewal[0]), static_cast<uint32_t>(renewal.size()), 3);
+
+        // Size the buffers of a few events, and those along the way.
+        uint32_t messages = callback.Messages() + InFlight;
+        callback.Hold(true);
+        for (uint32_t index = 0; index < InFlight; index++) {
+            Stub::Renew(sessionId, renewal);
+        }
+        callback.Hold(false);
+        EXPECT(callback.WaitForMessages(messages) == true);
+
+        const uint8_t* buffer = callback.MessageData();
+        const uint64_t threadAllocations = Test::ThreadAllocations();
+        const uint64_t allocations = Test::Allocations();
+
+        for (uint32_t index = 0; index < Renewals; index++) {
+            Stub::Renew(sessionId, renewal);
+            EXPECT(callback.WaitForMessages(++messages) == true);
+        }
+
+        EXPECT(Test::ThreadAllocations() == threadAllocations);
+        EXPECT(Test::Allocations() == allocations);
+        EXPECT(callback.Messages() == messages);
+        EXPECT(callback.MessageData() == buffer);
+        EXPECT(callback.Message() == ("1:Type:" + renewal));
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
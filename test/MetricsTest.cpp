@@ -0,0 +1,90 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The metrics as a host reads them through IMediaKeysStatistics.
+
+#include "Helpers.h"
+
+#include <Extensions.h>
+
+namespace {
+
+uint32_t Count(const std::string& text, const char character)
+{
+    uint32_t result = 0;
+    for (const char value : text) {
+        result += (value == character ? 1 : 0);
+    }
+    return (result);
+}
+
+} // namespace
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{\"metrics\":true}");
+    EXPECT(system != nullptr);
+
+    CDMi::IMediaKeysStatistics* statistics = dynamic_cast<CDMi::IMediaKeysStatistics*>(system);
+    EXPECT(statistics != nullptr);
+
+    if (statistics != nullptr) {
+        const Test::Key key(Test::MakeKey(3));
+        Test::Callback callback;
+        CDMi::IMediaKeySession* session = Test::Open(system, callback, { key });
+        EXPECT(session != nullptr);
+
+        static constexpr uint32_t Decrypts = 5;
+        static constexpr uint32_t Size = 1000;
+        const CDMi::EncryptionPattern pattern = { 0, 0 };
+        uint8_t iv[16] = {};
+        uint8_t data[Size];
+
+        for (uint32_t i = 0; i < Decrypts; i++) {
+            Test::Fill(data, Size, i);
+            EXPECT(Test::Decrypt(session, CDMi::AesCtr_Cenc, pattern, key, iv, data, Size) == CDMi::CDMi_SUCCESS);
+        }
+
+        // Failures are counted by the status they name.
+        const uint8_t garbage[] = { 1, 2, 3 };
+        session->Update(garbage, sizeof(garbage));
+        EXPECT(session->Load() != CDMi::CDMi_SUCCESS);
+
+        std::string result;
+        statistics->Statistics(result);
+
+        EXPECT(result.find("\"failures\":{\"typeerror\":1,\"sessionnotfound\":1}") != std::string::npos);
+
+        EXPECT(result.compare(0, 15, "{\"enabled\":true") == 0);
+        EXPECT(result.find(std::string("\"") + session->GetSessionId() + "\":{\"calls\":5,\"bytes\":5000,") != std::string::npos);
+        EXPECT(result.find("\"total\":{\"calls\":5,\"bytes\":5000,") != std::string::npos);
+        EXPECT(result.find("\"decrypt\":{\"count\":5,") != std::string::npos);
+        EXPECT(Count(result, '{') == Count(result, '}'));
+        EXPECT(Count(result, '[') == Count(result, ']'));
+        EXPECT(result[result.size() - 1] == '}');
+
+        system->DestroyMediaKeySession(session);
+
+        // Destroyed sessions still count in the total.
+        statistics->Statistics(result);
+        EXPECT(result.find("\"sessions\":{},\"total\":{\"calls\":5,\"bytes\":5000,") != std::string::npos);
+    }
+
+    return (Test::Result());
+}
@@ -0,0 +1,122 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Decrypting into the slots of a buffer registered through
+// IMediaKeySessionOutput: the clear sample lands in a slot, the ciphertext
+// is left alone, and each session has a pool of its own.
+
+#include "Helpers.h"
+
+#include <Extensions.h>
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":0}");
+    EXPECT(system != nullptr);
+
+    const Test::Key key(Test::MakeKey(3));
+    const Test::Key otherKey(Test::MakeKey(6));
+    Test::Callback first;
+    Test::Callback second;
+    CDMi::IMediaKeySession* session = Test::Open(system, first, { key });
+    CDMi::IMediaKeySession* other = Test::Open(system, second, { otherKey });
+    EXPECT((session != nullptr) && (other != nullptr));
+
+    CDMi::IMediaKeySessionOutput* output = dynamic_cast<CDMi::IMediaKeySessionOutput*>(session);
+    CDMi::IMediaKeySessionOutput* otherOutput = dynamic_cast<CDMi::IMediaKeySessionOutput*>(other);
+    EXPECT((output != nullptr) && (otherOutput != nullptr));
+
+    if ((output != nullptr) && (otherOutput != nullptr)) {
+        static constexpr uint32_t Size = 1024;
+        static constexpr uint8_t Slots = 2;
+        const CDMi::EncryptionPattern pattern = { 0, 0 };
+        uint8_t iv[16] = { 7, 1 };
+        uint8_t buffer[Size * Slots];
+        uint8_t otherBuffer[Size];
+        uint8_t clear[Size];
+        uint8_t sample[Size];
+        uint8_t encrypted[Size];
+        uint8_t otherEncrypted[Size];
+        Test::Fill(clear, Size, 4);
+        ::memcpy(encrypted, clear, Size);
+        ::memcpy(otherEncrypted, clear, Size);
+        Test::Encrypt(CDMi::AesCtr_Cenc, pattern, key, iv, encrypted, Size);
+        Test::Encrypt(CDMi::AesCtr_Cenc, pattern, otherKey, iv, otherEncrypted, Size);
+
+        EXPECT(output->RegisterOutputPool(nullptr, Size, Slots) == CDMi::CDMi_S_FALSE);
+        EXPECT(output->RegisterOutputPool(buffer, Size, 65) == CDMi::CDMi_S_FALSE);
+        EXPECT(output->RegisterOutputPool(buffer, Size, Slots) == CDMi::CDMi_SUCCESS);
+        // One pool per session at a time.
+        EXPECT(output->RegisterOutputPool(otherBuffer, Size, 1) == CDMi::CDMi_S_FALSE);
+        EXPECT(otherOutput->RegisterOutputPool(otherBuffer, Size, 1) == CDMi::CDMi_SUCCESS);
+
+        uint8_t* slots[Slots + 1];
+
+        for (uint8_t index = 0; index < (Slots + 1); index++) {
+            ::memcpy(sample, encrypted, Size);
+            EXPECT(Test::Decrypt(session, CDMi::AesCtr_Cenc, pattern, key, iv, sample, Size, &(slots[index])) == CDMi::CDMi_SUCCESS);
+            EXPECT(::memcmp(slots[index], clear, Size) == 0);
+        }
+
+        // Two slots, the third sample is decrypted in place.
+        EXPECT((slots[0] == &(buffer[0])) || (slots[0] == &(buffer[Size])));
+        EXPECT((slots[1] == &(buffer[0])) || (slots[1] == &(buffer[Size])));
+        EXPECT(slots[0] != slots[1]);
+        EXPECT(slots[2] == sample);
+
+        // The other session's pool is untouched by this one's.
+        ::memcpy(sample, otherEncrypted, Size);
+        uint8_t* otherSlot = nullptr;
+        EXPECT(Test::Decrypt(other, CDMi::AesCtr_Cenc, pattern, otherKey, iv, sample, Size, &otherSlot) == CDMi::CDMi_SUCCESS);
+        EXPECT(otherSlot == otherBuffer);
+        EXPECT(::memcmp(sample, otherEncrypted, Size) == 0);
+        EXPECT(::memcmp(otherBuffer, clear, Size) == 0);
+
+        // Not while a slot is out.
+        EXPECT(output->UnregisterOutputPool() == CDMi::CDMi_S_FALSE);
+        EXPECT(session->ReleaseClearContent(nullptr, 0, Size, slots[0]) == CDMi::CDMi_SUCCESS);
+        EXPECT(output->UnregisterOutputPool() == CDMi::CDMi_S_FALSE);
+        EXPECT(session->ReleaseClearContent(nullptr, 0, Size, slots[1]) == CDMi::CDMi_SUCCESS);
+        EXPECT(session->ReleaseClearContent(nullptr, 0, Size, slots[2]) == CDMi::CDMi_SUCCESS);
+        EXPECT(output->UnregisterOutputPool() == CDMi::CDMi_SUCCESS);
+        EXPECT(output->UnregisterOutputPool() == CDMi::CDMi_S_FALSE);
+
+        // Back to in place.
+        ::memcpy(sample, encrypted, Size);
+        uint8_t* result = nullptr;
+        EXPECT(Test::Decrypt(session, CDMi::AesCtr_Cenc, pattern, key, iv, sample, Size, &result) == CDMi::CDMi_SUCCESS);
+        EXPECT(result == sample);
+        EXPECT(::memcmp(sample, clear, Size) == 0);
+
+        EXPECT(otherOutput->UnregisterOutputPool() == CDMi::CDMi_S_FALSE);
+        EXPECT(other->ReleaseClearContent(nullptr, 0, Size, otherSlot) == CDMi::CDMi_SUCCESS);
+        EXPECT(otherOutput->UnregisterOutputPool() == CDMi::CDMi_SUCCESS);
+    }
+
+    if (session != nullptr) {
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+    if (other != nullptr) {
+        other->Close();
+        system->DestroyMediaKeySession(other);
+    }
+
+    return (Test::Result());
+}
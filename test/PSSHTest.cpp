@@ -0,0 +1,157 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The key ids the plugin reads from cenc init data, to find a session that
+// already holds them.
+
+#include "Helpers.h"
+
+#include <PSSH.h>
+
+namespace {
+
+const uint8_t g_widevine[] = { 0xed, 0xef, 0x8b, 0xa9, 0x79, 0xd6, 0x4a, 0xce, 0xa3, 0xc8, 0x27, 0xdc, 0xd5, 0x1d, 0x21, 0xed };
+const uint8_t g_playReady[] = { 0x9a, 0x04, 0xf0, 0x79, 0x98, 0x40, 0x42, 0x86, 0xab, 0x92, 0xe6, 0x5b, 0xe0, 0x88, 0x5f, 0x95 };
+
+void BE32(std::string& box, const uint32_t value)
+{
+    box += static_cast<char>(value >> 24);
+    box += static_cast<char>(value >> 16);
+    box += static_cast<char>(value >> 8);
+    box += static_cast<char>(value);
+}
+
+// The WidevinePsshData protobuf: an algorithm varint (field 1) and the key
+// ids (field 2).
+std::string WidevineData(const std::vector<Test::Key>& keys)
+{
+    std::string result("\x08\x01", 2);
+    for (const Test::Key& key : keys) {
+        result += static_cast<char>(0x12);
+        result += static_cast<char>(sizeof(key.id));
+        result.append(reinterpret_cast<const char*>(key.id), sizeof(key.id));
+    }
+    return (result);
+}
+
+std::string Box(const uint8_t systemId[16], const uint8_t version, const std::vector<Test::Key>& keys, const std::string& data)
+{
+    std::string box;
+    BE32(box, static_cast<uint32_t>(8 + 4 + 16 + (version > 0 ? 4 + (keys.size() * 16) : 0) + 4 + data.size()));
+    box += "pssh";
+    BE32(box, static_cast<uint32_t>(version) << 24);
+    box.append(reinterpret_cast<const char*>(systemId), 16);
+    if (version > 0) {
+        BE32(box, static_cast<uint32_t>(keys.size()));
+        for (const Test::Key& key : keys) {
+            box.append(reinterpret_cast<const char*>(key.id), sizeof(key.id));
+        }
+    }
+    BE32(box, static_cast<uint32_t>(data.size()));
+    box += data;
+    return (box);
+}
+
+bool Parse(const std::string& initData, CDMi::PSSH::KeyIds& keyIds)
+{
+    return (CDMi::PSSH::Parse(reinterpret_cast<const uint8_t*>(initData.data()), static_cast<uint32_t>(initData.size()), keyIds));
+}
+
+bool Holds(const CDMi::PSSH::KeyIds& keyIds, const std::vector<Test::Key>& keys)
+{
+    bool result = (keyIds.size() == keys.size());
+    for (uint32_t index = 0; (index < keys.size()) && (result == true); index++) {
+        result = (::memcmp(keyIds[index].bytes, keys[index].id, sizeof(keys[index].id)) == 0);
+    }
+    return (result);
+}
+
+} // namespace
+
+int main()
+{
+    const Test::Key first(Test::MakeKey(1));
+    const Test::Key second(Test::MakeKey(2));
+    const Test::Key third(Test::MakeKey(3));
+    CDMi::PSSH::KeyIds keyIds;
+
+    // The key id list of a version 1 box.
+    EXPECT(Parse(Box(g_widevine, 1, { first, second }, std::string()), keyIds) == true);
+    EXPECT(Holds(keyIds, { first, second }) == true);
+
+    // The key ids in the Widevine data of a version 0 box.
+    EXPECT(Parse(Box(g_widevine, 0, {}, WidevineData({ first, second })), keyIds) == true);
+    EXPECT(Holds(keyIds, { first, second }) == true);
+
+    // Both, a key id in both is reported once.
+    EXPECT(Parse(Box(g_widevine, 1, { first, second }, WidevineData({ second, third })), keyIds) == true);
+    EXPECT(Holds(keyIds, { first, second, third }) == true);
+
+    // The boxes of other systems are skipped.
+    EXPECT(Parse(Box(g_playReady, 1, { third }, "<WRMHEADER/>") + Box(g_widevine, 1, { first }, std::string()), keyIds) == true);
+    EXPECT(Holds(keyIds, { first }) == true);
+    EXPECT(Parse(Box(g_playReady, 1, { third }, std::string()), keyIds) == false);
+    EXPECT(keyIds.empty() == true);
+
+    // A 64 bit size, and a size of 0 for the last box.
+    {
+        const std::string box(Box(g_widevine, 1, { second }, std::string()));
+        std::string large;
+        BE32(large, 1);
+        large += "pssh";
+        BE32(large, 0);
+        BE32(large, static_cast<uint32_t>(box.size() + 8));
+        large.append(box, 8, std::string::npos);
+        EXPECT(Parse(large, keyIds) == true);
+        EXPECT(Holds(keyIds, { second }) == true);
+
+        std::string open(box);
+        open[0] = open[1] = open[2] = open[3] = 0;
+        EXPECT(Parse(Box(g_playReady, 0, {}, "x") + open, keyIds) == true);
+        EXPECT(Holds(keyIds, { second }) == true);
+    }
+
+    // Malformed init data is rejected.
+    {
+        const std::string box(Box(g_widevine, 1, { first, second }, WidevineData({ third })));
+
+        EXPECT(Parse(std::string(), keyIds) == false);
+        EXPECT(Parse(box.substr(0, box.size() - 1), keyIds) == false);
+
+        std::string small(box);
+        small[3] = 4;
+        EXPECT(Parse(small, keyIds) == false);
+
+        // More key ids than the box holds.
+        std::string count(box);
+        count[8 + 4 + 16 + 3] = 100;
+        EXPECT(Parse(count, keyIds) == false);
+
+        // Widevine data longer than the box.
+        std::string data(Box(g_widevine, 0, {}, WidevineData({ third })));
+        data[8 + 4 + 16 + 3] = 100;
+        EXPECT(Parse(data, keyIds) == false);
+
+        // A protobuf field running past its data, and an unknown wire type.
+        EXPECT(Parse(Box(g_widevine, 0, {}, std::string("\x12\x20", 2) + std::string(16, 'k')), keyIds) == false);
+        EXPECT(Parse(Box(g_widevine, 0, {}, std::string("\x0b\x00", 2)), keyIds) == false);
+    }
+
+    return (Test::Result());
+}
@@ -0,0 +1,74 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Large samples split over the decrypt workers ("decryptthreads"): the
+// ranges are decrypted separately and still make up the right clear sample.
+
+#include "Helpers.h"
+
+int main()
+{
+    static constexpr uint32_t Threads = 3;
+    static constexpr uint32_t Large = (1024 * 1024) + 5;
+    static constexpr uint32_t Small = 16 * 1024;
+
+    CDMi::IMediaKeys* system = Test::System("{\"decryptthreads\":" + std::to_string(Threads) + "}");
+    EXPECT(system != nullptr);
+
+    const Test::Key key(Test::MakeKey(21));
+    Test::Callback callback;
+    CDMi::IMediaKeySession* session = Test::Open(system, callback, { key });
+    EXPECT(session != nullptr);
+
+    if (session != nullptr) {
+        const CDMi::EncryptionPattern pattern = { 0, 0 };
+        const CDMi::EncryptionScheme schemes[] = { CDMi::AesCtr_Cenc, CDMi::AesCbc_Cbc1 };
+        // The counter carries over from the lower to the upper 64 bits within the sample.
+        const uint8_t iv[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 };
+
+        std::vector<uint8_t> clear(Large);
+        std::vector<uint8_t> sample(Large);
+        Test::Fill(clear.data(), Large, 4);
+
+        for (const CDMi::EncryptionScheme scheme : schemes) {
+            ::memcpy(sample.data(), clear.data(), Large);
+            Test::Encrypt(scheme, pattern, key, iv, sample.data(), Large);
+
+            // Split over the calling thread and all workers.
+            uint64_t calls = Stub::DecryptCalls();
+            EXPECT(Test::Decrypt(session, scheme, pattern, key, iv, sample.data(), Large) == CDMi::CDMi_SUCCESS);
+            EXPECT(::memcmp(sample.data(), clear.data(), Large) == 0);
+            EXPECT(Stub::DecryptCalls() == (calls + Threads + 1));
+
+            // Not worth splitting.
+            ::memcpy(sample.data(), clear.data(), Small);
+            Test::Encrypt(scheme, pattern, key, iv, sample.data(), Small);
+
+            calls = Stub::DecryptCalls();
+            EXPECT(Test::Decrypt(session, scheme, pattern, key, iv, sample.data(), Small) == CDMi::CDMi_SUCCESS);
+            EXPECT(::memcmp(sample.data(), clear.data(), Small) == 0);
+            EXPECT(Stub::DecryptCalls() == (calls + 1));
+        }
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
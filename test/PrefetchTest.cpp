@@ -0,0 +1,90 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Prefetching a license ahead of playback through IMediaKeysPrefetch: the
+// session created for the same init data plays without a license request.
+
+#include "Helpers.h"
+
+#include <Extensions.h>
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":0,\"prefetch\":2}");
+    EXPECT(system != nullptr);
+
+    CDMi::IMediaKeysPrefetch* prefetch = dynamic_cast<CDMi::IMediaKeysPrefetch*>(system);
+    EXPECT(prefetch != nullptr);
+
+    if (prefetch != nullptr) {
+        const Test::Key key(Test::MakeKey(5));
+        const Test::Key other(Test::MakeKey(9));
+        const std::string initData(Test::Pssh({ key }));
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(initData.data());
+        const uint32_t length = static_cast<uint32_t>(initData.size());
+
+        EXPECT(prefetch->Prefetch(CDMi::Temporary, "cenc", { initData, Test::Pssh({ other }) }) == 2);
+        // Already pending.
+        EXPECT(prefetch->Prefetch(CDMi::Temporary, "cenc", { initData }) == 1);
+        EXPECT(Stub::CreatedSessions() == 2);
+
+        std::string challenge;
+        EXPECT(prefetch->PrefetchChallenge(CDMi::Temporary, "cenc", data, length, challenge) == CDMi::CDMi_SUCCESS);
+        EXPECT(challenge.find("request:" + initData) != std::string::npos);
+        EXPECT(prefetch->PrefetchChallenge(CDMi::PersistentLicense, "cenc", data, length, challenge) == CDMi::CDMi_S_FALSE);
+
+        const std::string license(Test::License({ key }));
+        EXPECT(prefetch->PrefetchResponse(CDMi::Temporary, "cenc", data, length,
+                   reinterpret_cast<const uint8_t*>(license.data()), static_cast<uint32_t>(license.size())) == CDMi::CDMi_SUCCESS);
+
+        // Playback starts: the prefetched session is handed out.
+        CDMi::IMediaKeySession* session = nullptr;
+        EXPECT(system->CreateMediaKeySession("com.widevine.alpha", CDMi::Temporary, "cenc", data, length, nullptr, 0, &session) == CDMi::CDMi_SUCCESS);
+        EXPECT(Stub::CreatedSessions() == 2);
+
+        if (session != nullptr) {
+            Test::Callback callback;
+            session->Run(&callback);
+
+            EXPECT(callback.WaitForUpdates(1) == true);
+            EXPECT(callback.Messages() == 0);
+            EXPECT(callback.Usable() == 1);
+
+            static constexpr uint32_t Size = 512;
+            const CDMi::EncryptionPattern pattern = { 0, 0 };
+            uint8_t iv[16] = { 1, 2, 3 };
+            uint8_t clear[Size];
+            uint8_t sample[Size];
+            Test::Fill(clear, Size, 1);
+            ::memcpy(sample, clear, Size);
+            Test::Encrypt(CDMi::AesCtr_Cenc, pattern, key, iv, sample, Size);
+
+            EXPECT(Test::Decrypt(session, CDMi::AesCtr_Cenc, pattern, key, iv, sample, Size) == CDMi::CDMi_SUCCESS);
+            EXPECT(::memcmp(sample, clear, Size) == 0);
+
+            session->Close();
+            system->DestroyMediaKeySession(session);
+        }
+
+        // Handed out, no longer prefetched.
+        EXPECT(prefetch->PrefetchChallenge(CDMi::Temporary, "cenc", data, length, challenge) == CDMi::CDMi_S_FALSE);
+    }
+
+    return (Test::Result());
+}
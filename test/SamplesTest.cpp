@@ -0,0 +1,94 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Round trip of batched audio samples through DecryptSamples, reached
+// through the IMediaKeySessionDecrypt extension.
+
+#include "Helpers.h"
+
+#include <Extensions.h>
+
+namespace {
+
+typedef CDMi::IMediaKeySessionDecrypt::Sample Sample;
+
+void RoundTrip(CDMi::IMediaKeySessionDecrypt* session, const Test::Key& key, const CDMi::EncryptionScheme scheme, const uint32_t count)
+{
+    static const CDMi::EncryptionPattern none = { 0, 0 };
+
+    std::vector<std::vector<uint8_t>> clear(count);
+    std::vector<std::vector<uint8_t>> data(count);
+    std::vector<std::vector<uint8_t>> ivs(count, std::vector<uint8_t>(16, 0));
+    std::vector<Sample> samples(count);
+
+    for (uint32_t index = 0; index < count; index++) {
+        // Audio frame sized, not necessarily whole blocks.
+        const uint32_t length = 200 + ((index * 37) % 600);
+
+        clear[index].resize(length);
+        Test::Fill(clear[index].data(), length, index);
+        Test::Fill(ivs[index].data(), 8, index + 1000);
+
+        data[index] = clear[index];
+        Test::Encrypt(scheme, none, key, ivs[index].data(), data[index].data(), length);
+
+        samples[index].iv = ivs[index].data();
+        samples[index].ivLength = 16;
+        samples[index].data = data[index].data();
+        samples[index].length = length;
+    }
+
+    EXPECT(session->DecryptSamples(scheme, none, samples.data(), count, sizeof(key.id), key.id) == CDMi::CDMi_SUCCESS);
+    EXPECT(data == clear);
+}
+
+} // namespace
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{}");
+    Test::Callback callback;
+    const Test::Key key(Test::MakeKey(1));
+
+    CDMi::IMediaKeySession* session = Test::Open(system, callback, { key });
+    EXPECT(session != nullptr);
+
+    CDMi::IMediaKeySessionDecrypt* decrypt = dynamic_cast<CDMi::IMediaKeySessionDecrypt*>(session);
+    EXPECT(decrypt != nullptr);
+
+    if (decrypt != nullptr) {
+        RoundTrip(decrypt, key, CDMi::AesCtr_Cenc, 1);
+        RoundTrip(decrypt, key, CDMi::AesCtr_Cenc, 64);
+        RoundTrip(decrypt, key, CDMi::AesCbc_Cbcs, 8);
+
+        // Without a usable key nothing is decrypted.
+        const Test::Key unknown(Test::MakeKey(99));
+        uint8_t iv[16] = {};
+        uint8_t frame[64] = {};
+        const Sample sample = { iv, sizeof(iv), frame, sizeof(frame) };
+        EXPECT(decrypt->DecryptSamples(CDMi::AesCtr_Cenc, { 0, 0 }, &sample, 1, sizeof(unknown.id), unknown.id) == CDMi::CDMi_S_FALSE);
+    }
+
+    if (session != nullptr) {
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
@@ -0,0 +1,84 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Channel zapping with the session pool: CreateMediaKeySession takes a CDM
+// session that was created ahead of time instead of paying for
+// widevine::Cdm::createSession, and only pays when the pool ran dry.
+
+#include "Helpers.h"
+
+#include <thread>
+
+namespace {
+
+static constexpr uint32_t PoolSize = 2;
+static constexpr uint32_t CreateDelay = 100; // ms
+
+uint64_t Create(CDMi::IMediaKeys* system, const uint8_t seed, CDMi::IMediaKeySession*& session)
+{
+    const std::string initData(Test::Pssh({ Test::MakeKey(seed) }));
+    const uint64_t start = Test::Now();
+
+    if (system->CreateMediaKeySession("com.widevine.alpha", CDMi::Temporary, "cenc",
+            reinterpret_cast<const uint8_t*>(initData.data()), static_cast<uint32_t>(initData.size()),
+            nullptr, 0, &session) != CDMi::CDMi_SUCCESS) {
+        session = nullptr;
+    }
+    return ((Test::Now() - start) / 1000);
+}
+
+} // namespace
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":" + std::to_string(PoolSize) + "}");
+    EXPECT(system != nullptr);
+
+    // Both pools (temporary and persistent) fill up after start.
+    const uint64_t deadline = Test::Now() + 2000000;
+    while ((Stub::CreatedSessions() < (2 * PoolSize)) && (Test::Now() < deadline)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT(Stub::CreatedSessions() == (2 * PoolSize));
+
+    // From here on a CDM session takes a while to create.
+    Stub::CreateSessionDelay(CreateDelay);
+
+    std::vector<CDMi::IMediaKeySession*> sessions(PoolSize + 1, nullptr);
+
+    for (uint32_t index = 0; index < PoolSize; index++) {
+        const uint64_t elapsed = Create(system, static_cast<uint8_t>(index), sessions[index]);
+        EXPECT(sessions[index] != nullptr);
+        EXPECT(elapsed < (CreateDelay / 2));
+    }
+
+    // The refill is still under way, this one creates its own.
+    const uint64_t elapsed = Create(system, PoolSize, sessions[PoolSize]);
+    EXPECT(sessions[PoolSize] != nullptr);
+    EXPECT(elapsed >= (CreateDelay - 10));
+
+    for (CDMi::IMediaKeySession* session : sessions) {
+        if (session != nullptr) {
+            session->Close();
+            system->DestroyMediaKeySession(session);
+        }
+    }
+
+    return (Test::Result());
+}
@@ -0,0 +1,140 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Concurrent writers, readers and removers on a handful of names: whatever
+// order the writes reach the cache in, the files on disk end up holding
+// exactly what the cache holds.
+
+#include "Helpers.h"
+
+#include <HostImplementation.h>
+
+#include <atomic>
+#include <dirent.h>
+#include <map>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+static constexpr uint32_t Writers = 4;
+static constexpr uint32_t Iterations = 200;
+static constexpr uint32_t Names = 3;
+
+std::string Name(const uint32_t index)
+{
+    return (std::string("file") + std::to_string(index));
+}
+
+void Remove(const std::string& directory)
+{
+    DIR* dir = ::opendir(directory.c_str());
+    if (dir != nullptr) {
+        struct dirent* entry;
+        while ((entry = ::readdir(dir)) != nullptr) {
+            if (entry->d_name[0] != '.') {
+                ::unlink((directory + '/' + entry->d_name).c_str());
+            }
+        }
+        ::closedir(dir);
+    }
+    ::rmdir(directory.c_str());
+}
+
+} // namespace
+
+int main()
+{
+    char pattern[] = "/tmp/widevine-stress-XXXXXX";
+    const std::string location(::mkdtemp(pattern));
+
+    std::map<std::string, std::string> expected;
+    std::atomic<uint32_t> failures(0);
+
+    {
+        CDMi::HostImplementation host;
+        EXPECT(host.Open(location) == true);
+
+        std::atomic<bool> done(false);
+        std::vector<std::thread> threads;
+
+        for (uint32_t writer = 0; writer < Writers; writer++) {
+            threads.emplace_back([&host, &failures, writer]() {
+                for (uint32_t i = 0; i < Iterations; i++) {
+                    // Sizes vary so both the copied and the mapped files are hit.
+                    const std::string content(((writer * Iterations) + i) * 37 % 6000 + 1, static_cast<char>('a' + writer));
+                    if (host.write(Name(i % Names), content) == false) {
+                        failures++;
+                    }
+                }
+            });
+        }
+
+        // Writes and removes a name of its own, ends with it removed.
+        threads.emplace_back([&host, &failures]() {
+            for (uint32_t i = 0; i < Iterations; i++) {
+                if ((host.write("removed", std::string(i + 1, 'r')) == false) || (host.remove("removed") == false)) {
+                    failures++;
+                }
+            }
+        });
+
+        threads.emplace_back([&host, &done]() {
+            std::string content;
+            while (done == false) {
+                for (uint32_t i = 0; i < Names; i++) {
+                    host.read(Name(i), &content);
+                    host.size(Name(i));
+                }
+            }
+        });
+
+        for (uint32_t i = 0; i < (threads.size() - 1); i++) {
+            threads[i].join();
+        }
+        done = true;
+        threads.back().join();
+
+        for (uint32_t i = 0; i < Names; i++) {
+            EXPECT(host.read(Name(i), &expected[Name(i)]) == true);
+        }
+        EXPECT(host.exists("removed") == false);
+    }
+
+    EXPECT(failures == 0);
+
+    {
+        CDMi::HostImplementation host;
+        EXPECT(host.Open(location) == true);
+
+        for (const std::pair<const std::string, std::string>& entry : expected) {
+            std::string content;
+            EXPECT((host.read(entry.first, &content) == true) && (content == entry.second));
+        }
+        EXPECT(host.exists("removed") == false);
+
+        std::vector<std::string> names;
+        EXPECT((host.list(&names) == true) && (names.size() == Names));
+    }
+
+    Remove(location);
+
+    return (Test::Result());
+}
@@ -0,0 +1,168 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The storage backend across a restart: a new HostImplementation on the
+// same storage location serves what the previous one wrote, including the
+// persistent license the CDM stored, and nothing it removed.
+
+#include "Helpers.h"
+
+#include <HostImplementation.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+class Listener : public widevine::Cdm::IEventListener {
+public:
+    void onMessage(const std::string&, widevine::Cdm::MessageType, const std::string&) override {}
+    void onKeyStatusesChange(const std::string&, bool) override {}
+    void onRemoveComplete(const std::string&) override {}
+    void onDeferredComplete(const std::string&, widevine::Cdm::Status) override {}
+    void onDirectIndividualizationRequest(const std::string&, const std::string&) override {}
+};
+
+bool OnDisk(const std::string& path)
+{
+    struct stat info;
+    return (::stat(path.c_str(), &info) == 0);
+}
+
+void Remove(const std::string& directory)
+{
+    DIR* dir = ::opendir(directory.c_str());
+    if (dir != nullptr) {
+        struct dirent* entry;
+        while ((entry = ::readdir(dir)) != nullptr) {
+            if (entry->d_name[0] != '.') {
+                ::unlink((directory + '/' + entry->d_name).c_str());
+            }
+        }
+        ::closedir(dir);
+    }
+    ::rmdir(directory.c_str());
+}
+
+} // namespace
+
+int main()
+{
+    char pattern[] = "/tmp/widevine-storage-XXXXXX";
+    const std::string directory(::mkdtemp(pattern));
+    const std::string location(directory + "/store");
+
+    const std::string small("small file");
+    std::string large(16 * 1024, '\0');
+    Test::Fill(reinterpret_cast<uint8_t*>(&large[0]), static_cast<uint32_t>(large.size()), 1);
+
+    const Test::Key key(Test::MakeKey(7));
+    Listener listener;
+    widevine::Cdm::ClientInfo client;
+    std::string sessionId;
+
+    {
+        CDMi::HostImplementation host;
+        EXPECT(host.Open(location) == true);
+
+        EXPECT(host.write("small", small) == true);
+        EXPECT(host.write("large", large) == true);
+        EXPECT(host.write("gone", small) == true);
+        EXPECT(host.remove("gone") == true);
+
+        EXPECT(widevine::Cdm::initialize(widevine::Cdm::kNoSecureOutput, client, &host, &host, &host, widevine::Cdm::kErrors) == widevine::Cdm::kSuccess);
+        widevine::Cdm* cdm = widevine::Cdm::create(&listener, &host, false);
+
+        EXPECT(cdm->createSession(widevine::Cdm::kPersistentLicense, &sessionId) == widevine::Cdm::kSuccess);
+        EXPECT(cdm->update(sessionId, Test::License({ key })) == widevine::Cdm::kSuccess);
+        EXPECT(cdm->close(sessionId) == widevine::Cdm::kSuccess);
+
+        delete cdm;
+    }
+
+    // An interrupted write leaves its temporary file behind.
+    const int fd = ::open((location + "/small.tmp").c_str(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+    EXPECT(fd >= 0);
+    ::close(fd);
+
+    EXPECT(OnDisk(location + "/small") == true);
+    EXPECT(OnDisk(location + "/gone") == false);
+
+    {
+        CDMi::HostImplementation host;
+        EXPECT(host.Open(location) == true);
+
+        std::string content;
+        EXPECT((host.read("small", &content) == true) && (content == small));
+        EXPECT((host.read("large", &content) == true) && (content == large));
+        EXPECT(host.exists("gone") == false);
+        EXPECT(host.size("large") == static_cast<int32_t>(large.size()));
+        EXPECT(OnDisk(location + "/small.tmp") == false);
+
+        // The persistent license loads into a fresh CDM.
+        EXPECT(widevine::Cdm::initialize(widevine::Cdm::kNoSecureOutput, client, &host, &host, &host, widevine::Cdm::kErrors) == widevine::Cdm::kSuccess);
+        widevine::Cdm* cdm = widevine::Cdm::create(&listener, &host, false);
+
+        EXPECT(cdm->load(sessionId) == widevine::Cdm::kSuccess);
+
+        widevine::Cdm::KeyStatusMap statuses;
+        EXPECT(cdm->getKeyStatuses(sessionId, &statuses) == widevine::Cdm::kSuccess);
+        EXPECT((statuses.size() == 1) && (statuses.begin()->second == widevine::Cdm::kUsable));
+
+        EXPECT(cdm->remove(sessionId) == widevine::Cdm::kSuccess);
+        delete cdm;
+
+        EXPECT(host.remove("small") == true);
+    }
+
+    {
+        CDMi::HostImplementation host;
+        EXPECT(host.Open(location) == true);
+
+        std::vector<std::string> names;
+        EXPECT(host.list(&names) == true);
+        EXPECT((names.size() == 1) && (names[0] == "large"));
+    }
+
+    {
+        // A file outside the storage directory may be rewritten in place
+        // after it was loaded, its content must have been copied.
+        const std::string external(directory + "/cert.bin");
+        int fd = ::open(external.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        EXPECT((fd >= 0) && (::write(fd, large.data(), large.size()) == static_cast<ssize_t>(large.size())));
+        ::close(fd);
+
+        CDMi::HostImplementation host;
+        EXPECT(host.LoadFile("cert.bin", external) == true);
+
+        fd = ::open(external.c_str(), O_WRONLY | O_TRUNC);
+        ::close(fd);
+
+        std::string content;
+        EXPECT((host.read("cert.bin", &content) == true) && (content == large));
+    }
+
+    Remove(location);
+    Remove(directory);
+
+    return (Test::Result());
+}
@@ -0,0 +1,136 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Samples fed to Decrypt in chunks (initWithLast15): the chunks of the
+// samples of two tracks interleave on one session, a chunk that does not
+// match the scheme or pattern of its sample fails.
+
+#include "Helpers.h"
+
+namespace {
+
+CDMi::CDMi_RESULT Chunk(CDMi::IMediaKeySession* session, const CDMi::EncryptionScheme scheme, const CDMi::EncryptionPattern& pattern,
+    const Test::Key& key, const uint8_t iv[16], uint8_t* data, const uint32_t length, const bool first)
+{
+    uint32_t clearLength = 0;
+    uint8_t* clear = nullptr;
+
+    const CDMi::CDMi_RESULT result = session->Decrypt(nullptr, 0, scheme, pattern, iv, 16, data, length,
+        &clearLength, &clear, sizeof(key.id), key.id, (first == false));
+
+    if ((result == CDMi::CDMi_SUCCESS) && (clear != data)) {
+        ::memcpy(data, clear, length);
+        session->ReleaseClearContent(nullptr, 0, clearLength, clear);
+    }
+    return (result);
+}
+
+} // namespace
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":0}");
+    EXPECT(system != nullptr);
+
+    const std::vector<Test::Key> keys({ Test::MakeKey(1), Test::MakeKey(2), Test::MakeKey(3), Test::MakeKey(4), Test::MakeKey(5) });
+    const Test::Key& video(keys[0]);
+    const Test::Key& audio(keys[1]);
+    Test::Callback callback;
+    CDMi::IMediaKeySession* session = Test::Open(system, callback, keys);
+    EXPECT(session != nullptr);
+
+    if (session != nullptr) {
+        static constexpr uint32_t VideoSize = 1000;
+        static constexpr uint32_t AudioSize = 320;
+        const CDMi::EncryptionPattern none = { 0, 0 };
+        const CDMi::EncryptionPattern cens = { 1, 9 };
+        const uint8_t videoIV[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 0, 0, 0, 0, 0, 0, 0, 0xF0 };
+        const uint8_t audioIV[16] = { 9, 8, 7 };
+        uint8_t videoClear[VideoSize];
+        uint8_t audioClear[AudioSize];
+        uint8_t videoSample[VideoSize];
+        uint8_t audioSample[AudioSize];
+        Test::Fill(videoClear, VideoSize, 1);
+        Test::Fill(audioClear, AudioSize, 2);
+
+        // CTR, chunks ending within counter blocks.
+        ::memcpy(videoSample, videoClear, VideoSize);
+        ::memcpy(audioSample, audioClear, AudioSize);
+        Test::Encrypt(CDMi::AesCtr_Cenc, none, video, videoIV, videoSample, VideoSize);
+        Test::Encrypt(CDMi::AesCtr_Cenc, none, audio, audioIV, audioSample, AudioSize);
+
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, video, videoIV, &(videoSample[0]), 100, true) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, audio, audioIV, &(audioSample[0]), 37, true) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, video, nullptr, &(videoSample[100]), 513, false) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, audio, nullptr, &(audioSample[37]), AudioSize - 37, false) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, video, nullptr, &(videoSample[613]), VideoSize - 613, false) == CDMi::CDMi_SUCCESS);
+        EXPECT(::memcmp(videoSample, videoClear, VideoSize) == 0);
+        EXPECT(::memcmp(audioSample, audioClear, AudioSize) == 0);
+
+        // CBC, whole block chunks.
+        ::memcpy(videoSample, videoClear, 512);
+        ::memcpy(audioSample, audioClear, 256);
+        Test::Encrypt(CDMi::AesCbc_Cbc1, none, video, videoIV, videoSample, 512);
+        Test::Encrypt(CDMi::AesCbc_Cbc1, none, audio, audioIV, audioSample, 256);
+
+        EXPECT(Chunk(session, CDMi::AesCbc_Cbc1, none, video, videoIV, &(videoSample[0]), 128, true) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCbc_Cbc1, none, audio, audioIV, &(audioSample[0]), 128, true) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCbc_Cbc1, none, video, nullptr, &(videoSample[128]), 256, false) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCbc_Cbc1, none, audio, nullptr, &(audioSample[128]), 128, false) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCbc_Cbc1, none, video, nullptr, &(videoSample[384]), 128, false) == CDMi::CDMi_SUCCESS);
+        EXPECT(::memcmp(videoSample, videoClear, 512) == 0);
+        EXPECT(::memcmp(audioSample, audioClear, 256) == 0);
+
+        // Patterned, whole cycle chunks.
+        ::memcpy(videoSample, videoClear, 480);
+        Test::Encrypt(CDMi::AesCtr_Cens, cens, video, videoIV, videoSample, 480);
+
+        EXPECT(Chunk(session, CDMi::AesCtr_Cens, cens, video, videoIV, &(videoSample[0]), 160, true) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCtr_Cens, cens, video, nullptr, &(videoSample[160]), 320, false) == CDMi::CDMi_SUCCESS);
+        EXPECT(::memcmp(videoSample, videoClear, 480) == 0);
+
+        // A continuation in another scheme or pattern fails, and ends the
+        // sample.
+        ::memcpy(videoSample, videoClear, 512);
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, video, videoIV, &(videoSample[0]), 128, true) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCbc_Cbc1, none, video, nullptr, &(videoSample[128]), 128, false) == CDMi::CDMi_S_FALSE);
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, video, nullptr, &(videoSample[256]), 128, false) == CDMi::CDMi_S_FALSE);
+
+        EXPECT(Chunk(session, CDMi::AesCtr_Cens, cens, video, videoIV, &(videoSample[0]), 160, true) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCtr_Cens, { 2, 8 }, video, nullptr, &(videoSample[160]), 160, false) == CDMi::CDMi_S_FALSE);
+
+        // Without a sample started for the key id.
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, keys[2], nullptr, videoSample, 128, false) == CDMi::CDMi_S_FALSE);
+
+        // The least recently started sample gives way to one for a fifth
+        // key id.
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, video, videoIV, videoSample, 32, true) == CDMi::CDMi_SUCCESS);
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, audio, audioIV, audioSample, 32, true) == CDMi::CDMi_SUCCESS);
+        for (uint8_t index = 2; index < keys.size(); index++) {
+            EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, keys[index], audioIV, audioSample, 32, true) == CDMi::CDMi_SUCCESS);
+        }
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, video, nullptr, videoSample, 32, false) == CDMi::CDMi_S_FALSE);
+        EXPECT(Chunk(session, CDMi::AesCtr_Cenc, none, audio, nullptr, audioSample, 32, false) == CDMi::CDMi_SUCCESS);
+
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
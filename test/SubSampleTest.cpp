@@ -0,0 +1,148 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// DecryptSubSamples against samples encrypted the way each scheme defines
+// it, reached through the IMediaKeySessionDecrypt extension.
+
+#include "Helpers.h"
+
+#include <Extensions.h>
+
+namespace {
+
+typedef CDMi::IMediaKeySessionDecrypt::SubSample SubSample;
+
+void Advance(uint8_t iv[], uint64_t blocks)
+{
+    for (int index = 15; (index >= 8) && (blocks != 0); index--) {
+        const uint64_t sum = iv[index] + (blocks & 0xFF);
+        iv[index] = static_cast<uint8_t>(sum);
+        blocks = (blocks >> 8) + (sum >> 8);
+    }
+}
+
+uint64_t EncryptedBlocks(const CDMi::EncryptionPattern& pattern, const uint32_t length)
+{
+    const uint64_t blocks = length / 16;
+    const uint64_t cycle = pattern.encrypted_blocks + pattern.clear_blocks;
+
+    if (pattern.encrypted_blocks == 0) {
+        return (blocks);
+    }
+    return (((blocks / cycle) * pattern.encrypted_blocks) + std::min<uint64_t>(blocks % cycle, pattern.encrypted_blocks));
+}
+
+// Encrypts the protected runs: as one stream (cenc, cbc1) or run by run.
+void Encrypt(const CDMi::EncryptionScheme scheme, const CDMi::EncryptionPattern& pattern, const Test::Key& key, const uint8_t iv[16],
+    std::vector<uint8_t>& sample, const std::vector<SubSample>& map)
+{
+    if ((scheme == CDMi::AesCtr_Cenc) || (scheme == CDMi::AesCbc_Cbc1)) {
+        std::vector<uint8_t> stream;
+        uint32_t offset = 0;
+
+        for (const SubSample& entry : map) {
+            offset += entry.clearBytes;
+            stream.insert(stream.end(), &(sample[offset]), &(sample[offset]) + entry.encryptedBytes);
+            offset += entry.encryptedBytes;
+        }
+
+        Test::Encrypt(scheme, { 0, 0 }, key, iv, stream.data(), static_cast<uint32_t>(stream.size()));
+
+        offset = 0;
+        uint32_t position = 0;
+        for (const SubSample& entry : map) {
+            offset += entry.clearBytes;
+            ::memcpy(&(sample[offset]), &(stream[position]), entry.encryptedBytes);
+            offset += entry.encryptedBytes;
+            position += entry.encryptedBytes;
+        }
+    } else {
+        uint8_t counter[16];
+        uint32_t offset = 0;
+
+        ::memcpy(counter, iv, sizeof(counter));
+
+        for (const SubSample& entry : map) {
+            offset += entry.clearBytes;
+            Test::Encrypt(scheme, pattern, key, (scheme == CDMi::AesCtr_Cens ? counter : iv), &(sample[offset]), entry.encryptedBytes);
+            Advance(counter, EncryptedBlocks(pattern, entry.encryptedBytes));
+            offset += entry.encryptedBytes;
+        }
+    }
+}
+
+void Check(CDMi::IMediaKeySessionDecrypt* session, const Test::Key& key, const CDMi::EncryptionScheme scheme, const CDMi::EncryptionPattern& pattern,
+    const std::vector<SubSample>& map, const uint32_t seed)
+{
+    uint32_t length = 0;
+    for (const SubSample& entry : map) {
+        length += entry.clearBytes + entry.encryptedBytes;
+    }
+
+    std::vector<uint8_t> clear(length);
+    Test::Fill(clear.data(), length, seed);
+
+    uint8_t iv[16];
+    Test::Fill(iv, 8, seed);
+    ::memset(&(iv[8]), 0, 8);
+
+    std::vector<uint8_t> sample(clear);
+    Encrypt(scheme, pattern, key, iv, sample, map);
+    EXPECT(sample != clear);
+
+    EXPECT(session->DecryptSubSamples(scheme, pattern, iv, sizeof(iv), sample.data(), length,
+        map.data(), static_cast<uint32_t>(map.size()), sizeof(key.id), key.id) == CDMi::CDMi_SUCCESS);
+    EXPECT(sample == clear);
+}
+
+} // namespace
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{}");
+    Test::Callback callback;
+    const Test::Key key(Test::MakeKey(1));
+
+    CDMi::IMediaKeySession* session = Test::Open(system, callback, { key });
+    EXPECT(session != nullptr);
+
+    CDMi::IMediaKeySessionDecrypt* decrypt = dynamic_cast<CDMi::IMediaKeySessionDecrypt*>(session);
+    EXPECT(decrypt != nullptr);
+
+    if (decrypt != nullptr) {
+        // Protected runs that do not end on a block boundary carry the
+        // counter into the next run.
+        Check(decrypt, key, CDMi::AesCtr_Cenc, { 0, 0 }, { { 5, 100 }, { 37, 13 }, { 0, 4000 } }, 1);
+        Check(decrypt, key, CDMi::AesCbc_Cbc1, { 0, 0 }, { { 5, 96 }, { 37, 32 }, { 3, 4000 } }, 2);
+        Check(decrypt, key, CDMi::AesCtr_Cens, { 1, 9 }, { { 5, 480 }, { 37, 160 }, { 3, 800 } }, 3);
+        Check(decrypt, key, CDMi::AesCbc_Cbcs, { 1, 9 }, { { 5, 480 }, { 37, 170 }, { 3, 800 } }, 4);
+        // A cbcs sample without a pattern still restarts from the IV on
+        // every subsample, it is not one chain.
+        Check(decrypt, key, CDMi::AesCbc_Cbcs, { 0, 0 }, { { 5, 96 }, { 37, 32 }, { 3, 4000 } }, 5);
+        // Large enough to be split over the decrypt engine, if it has workers.
+        Check(decrypt, key, CDMi::AesCtr_Cenc, { 0, 0 }, { { 64, 200000 }, { 64, 300001 } }, 6);
+    }
+
+    if (session != nullptr) {
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
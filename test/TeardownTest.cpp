@@ -0,0 +1,152 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Destroying a session while CDM events for it are queued and one is being
+// delivered: DestroyMediaKeySession waits for the callback in progress and
+// no callback reaches the application afterwards.
+
+#include "Helpers.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+static constexpr uint32_t Rounds = 10;
+static constexpr uint32_t Renewals = 20;
+
+// Holds the first message until released, so the session is destroyed
+// while a callback is in progress and the other renewals are queued.
+class Callback : public CDMi::IMediaKeySessionCallback {
+public:
+    Callback()
+        : _lock()
+        , _changed()
+        , _entered(false)
+        , _released(false)
+        , _destroyed(false)
+        , _inside(false)
+        , _messages(0)
+        , _late(0)
+    {
+    }
+
+    void OnKeyMessage(const uint8_t*, uint32_t, const char*) override
+    {
+        Enter();
+        std::unique_lock<std::mutex> lock(_lock);
+        _entered = true;
+        _changed.notify_all();
+        _changed.wait(lock, [this]() { return (_released); });
+        _messages++;
+        _inside = false;
+    }
+    void OnError(int16_t, CDMi::CDMi_RESULT, const char*) override { Enter(); _inside = false; }
+    void OnKeyStatusUpdate(const char*, const uint8_t*, const uint8_t) override { Enter(); _inside = false; }
+    void OnKeyStatusesUpdated() const override { const_cast<Callback*>(this)->Enter(); _inside = false; }
+
+    void WaitForEntered()
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _changed.wait(lock, [this]() { return (_entered); });
+    }
+    void Release()
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _released = true;
+        _changed.notify_all();
+    }
+    void Destroyed() { _destroyed = true; }
+    bool Inside() const { return (_inside); }
+    uint32_t Messages() const { return (_messages); }
+    uint32_t Late() const { return (_late); }
+
+private:
+    void Enter()
+    {
+        _inside = true;
+        if (_destroyed == true) {
+            _late++;
+        }
+    }
+
+private:
+    std::mutex _lock;
+    std::condition_variable _changed;
+    bool _entered;
+    bool _released;
+    std::atomic<bool> _destroyed;
+    mutable std::atomic<bool> _inside;
+    std::atomic<uint32_t> _messages;
+    std::atomic<uint32_t> _late;
+};
+
+} // namespace
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{}");
+    EXPECT(system != nullptr);
+
+    for (uint32_t round = 0; round < Rounds; round++) {
+        const Test::Key key(Test::MakeKey(static_cast<uint8_t>(round)));
+        Test::Callback setup;
+        CDMi::IMediaKeySession* session = Test::Open(system, setup, { key });
+        EXPECT(session != nullptr);
+        if (session == nullptr) {
+            break;
+        }
+
+        Callback callback;
+        session->Run(&callback);
+
+        // Posting does not wait for the application.
+        const std::string sessionId(session->GetSessionId());
+        for (uint32_t i = 0; i < Renewals; i++) {
+            Stub::Renew(sessionId);
+        }
+
+        callback.WaitForEntered();
+
+        std::atomic<bool> returned(false);
+        std::thread destroyer([&]() {
+            system->DestroyMediaKeySession(session);
+            callback.Destroyed();
+            returned = true;
+        });
+
+        // Destroy waits for the callback in progress.
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        EXPECT(returned == false);
+
+        callback.Release();
+        destroyer.join();
+
+        EXPECT(callback.Inside() == false);
+
+        // Nothing of what was still queued is delivered.
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        EXPECT(callback.Messages() == 1);
+        EXPECT(callback.Late() == 0);
+    }
+
+    return (Test::Result());
+}
@@ -0,0 +1,99 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The timer wheel: timers never fire early, also not the ones beyond the
+// reach of the wheel, revoked timers do not fire and a client can revoke
+// its own timers from within its callback.
+
+#include "Helpers.h"
+
+#include <TimerWheel.h>
+
+#include <atomic>
+#include <thread>
+
+namespace {
+
+class Client : public CDMi::TimerWheel::IClient {
+public:
+    Client(CDMi::TimerWheel& wheel, const bool revoke)
+        : _wheel(wheel)
+        , _revoke(revoke)
+        , _fired(0)
+        , _firedAt(0)
+    {
+    }
+
+    void onTimerExpired(void* /* context */) override
+    {
+        _firedAt = Test::Now();
+        _fired++;
+        if (_revoke == true) {
+            _wheel.Revoke(this);
+        }
+    }
+
+    uint32_t Fired() const { return (_fired); }
+    uint64_t FiredAt() const { return (_firedAt); }
+
+private:
+    CDMi::TimerWheel& _wheel;
+    const bool _revoke;
+    std::atomic<uint32_t> _fired;
+    std::atomic<uint64_t> _firedAt;
+};
+
+} // namespace
+
+int main()
+{
+    CDMi::TimerWheel wheel(1);
+
+    Client early(wheel, false);
+    Client late(wheel, false);
+    Client revoked(wheel, false);
+    Client self(wheel, true);
+    Client beyond(wheel, false);
+
+    const uint64_t start = Test::Now();
+
+    wheel.Schedule(20, &early, nullptr);
+    wheel.Schedule(5000, &late, nullptr);
+    wheel.Schedule(60, &late, nullptr); // replaces the 5 s timer
+    wheel.Schedule(30, &revoked, nullptr);
+    wheel.Schedule(40, &self, nullptr);
+    // Far beyond the reach of the wheel (2^24 ticks).
+    wheel.Schedule(static_cast<uint64_t>(3) << 24, &beyond, nullptr);
+
+    wheel.Revoke(&revoked);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    EXPECT(early.Fired() == 1);
+    EXPECT(early.FiredAt() >= (start + 20000));
+    EXPECT(late.Fired() == 1);
+    EXPECT(late.FiredAt() >= (start + 60000));
+    EXPECT(revoked.Fired() == 0);
+    EXPECT(self.Fired() == 1);
+    EXPECT(beyond.Fired() == 0);
+
+    wheel.Revoke(&beyond);
+
+    return (Test::Result());
+}
@@ -0,0 +1,143 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Waiting for a key through IMediaKeySessionDecrypt instead of retrying
+// Decrypt: released by the license, by a cancel, by the timeout or by
+// destroying the session.
+
+#include "Helpers.h"
+
+#include <Extensions.h>
+
+#include <thread>
+
+int main()
+{
+    CDMi::IMediaKeys* system = Test::System("{\"sessionpool\":0}");
+    EXPECT(system != nullptr);
+
+    const Test::Key key(Test::MakeKey(4));
+    const Test::Key other(Test::MakeKey(8));
+    const std::string initData(Test::Pssh({ key }));
+    CDMi::IMediaKeySession* session = nullptr;
+
+    EXPECT(system->CreateMediaKeySession("com.widevine.alpha", CDMi::Temporary, "cenc",
+               reinterpret_cast<const uint8_t*>(initData.data()), static_cast<uint32_t>(initData.size()),
+               nullptr, 0, &session) == CDMi::CDMi_SUCCESS);
+
+    CDMi::IMediaKeySessionDecrypt* decrypt = dynamic_cast<CDMi::IMediaKeySessionDecrypt*>(session);
+    EXPECT(decrypt != nullptr);
+
+    if (decrypt != nullptr) {
+        Test::Callback callback;
+        session->Run(&callback);
+        EXPECT(callback.WaitForMessages(1) == true);
+
+        // Times out while there is no license.
+        uint64_t start = Test::Now();
+        EXPECT(decrypt->WaitForKey(sizeof(key.id), key.id, 100) == CDMi::CDMi_S_FALSE);
+        EXPECT((Test::Now() - start) >= 100000);
+
+        // A cancel releases the waiter long before its timeout.
+        CDMi::CDMi_RESULT cancelled = CDMi::CDMi_SUCCESS;
+        start = Test::Now();
+        std::thread waiter([&]() {
+            cancelled = decrypt->WaitForKey(sizeof(key.id), key.id, 10000);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        decrypt->CancelWaitForKey();
+        waiter.join();
+        EXPECT(cancelled == CDMi::CDMi_S_FALSE);
+        EXPECT((Test::Now() - start) < 5000000);
+
+        // The license releases the waiters for its key, not those for others.
+        CDMi::CDMi_RESULT usable = CDMi::CDMi_S_FALSE;
+        CDMi::CDMi_RESULT unknown = CDMi::CDMi_SUCCESS;
+        start = Test::Now();
+        std::thread keyed([&]() {
+            usable = decrypt->WaitForKey(sizeof(key.id), key.id, 10000);
+        });
+        std::thread unrelated([&]() {
+            unknown = decrypt->WaitForKey(sizeof(other.id), other.id, 300);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        const std::string license(Test::License({ key }));
+        session->Update(reinterpret_cast<const uint8_t*>(license.data()), static_cast<uint32_t>(license.size()));
+
+        keyed.join();
+        unrelated.join();
+        EXPECT(usable == CDMi::CDMi_SUCCESS);
+        EXPECT(unknown == CDMi::CDMi_S_FALSE);
+        EXPECT((Test::Now() - start) < 5000000);
+
+        // Already usable, by key id or any key.
+        EXPECT(decrypt->WaitForKey(sizeof(key.id), key.id, 0) == CDMi::CDMi_SUCCESS);
+        EXPECT(decrypt->WaitForKey(0, nullptr, 0) == CDMi::CDMi_SUCCESS);
+
+        // Any key is found whichever of the two expired, only none left
+        // usable fails.
+        const std::string sessionId(session->GetSessionId());
+        const std::string both(Test::License({ key, other }));
+        session->Update(reinterpret_cast<const uint8_t*>(both.data()), static_cast<uint32_t>(both.size()));
+        Stub::Expire(sessionId, key.id);
+        EXPECT(decrypt->WaitForKey(sizeof(key.id), key.id, 0) == CDMi::CDMi_S_FALSE);
+        EXPECT(decrypt->WaitForKey(0, nullptr, 0) == CDMi::CDMi_SUCCESS);
+        session->Update(reinterpret_cast<const uint8_t*>(both.data()), static_cast<uint32_t>(both.size()));
+        Stub::Expire(sessionId, other.id);
+        EXPECT(decrypt->WaitForKey(0, nullptr, 0) == CDMi::CDMi_SUCCESS);
+        Stub::Expire(sessionId, key.id);
+        EXPECT(decrypt->WaitForKey(0, nullptr, 0) == CDMi::CDMi_S_FALSE);
+    }
+
+    // Destroying a session releases its waiters before it is deleted.
+    CDMi::IMediaKeySession* waited = nullptr;
+    EXPECT(system->CreateMediaKeySession("com.widevine.alpha", CDMi::Temporary, "cenc",
+               reinterpret_cast<const uint8_t*>(initData.data()), static_cast<uint32_t>(initData.size()),
+               nullptr, 0, &waited) == CDMi::CDMi_SUCCESS);
+
+    CDMi::IMediaKeySessionDecrypt* pending = dynamic_cast<CDMi::IMediaKeySessionDecrypt*>(waited);
+    EXPECT(pending != nullptr);
+
+    if (pending != nullptr) {
+        Test::Callback callback;
+        waited->Run(&callback);
+        EXPECT(callback.WaitForMessages(1) == true);
+
+        const Test::Key missing(Test::MakeKey(12));
+        CDMi::CDMi_RESULT destroyed = CDMi::CDMi_SUCCESS;
+        const uint64_t start = Test::Now();
+        std::thread waiter([&]() {
+            destroyed = pending->WaitForKey(sizeof(missing.id), missing.id, 10000);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        waited->Close();
+        system->DestroyMediaKeySession(waited);
+        waiter.join();
+        EXPECT(destroyed == CDMi::CDMi_S_FALSE);
+        EXPECT((Test::Now() - start) < 5000000);
+    }
+
+    if (session != nullptr) {
+        session->Close();
+        system->DestroyMediaKeySession(session);
+    }
+
+    return (Test::Result());
+}
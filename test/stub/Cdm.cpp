@@ -0,0 +1,573 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StubCdm.h"
+#include "string_conversions.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+namespace {
+
+struct Key {
+    uint8_t id[Stub::KeySize];
+    uint8_t value[Stub::KeySize];
+    bool expired;
+};
+
+typedef std::vector<Key> Keys;
+
+struct Session {
+    widevine::Cdm::SessionType type;
+    Keys keys;
+    bool released;
+};
+
+std::atomic<uint32_t> g_initializeDelay(0);
+std::atomic<uint32_t> g_createSessionDelay(0);
+std::atomic<uint32_t> g_createdSessions(0);
+std::atomic<uint32_t> g_openSessions(0);
+std::atomic<uint64_t> g_decryptCalls(0);
+std::atomic<uint32_t> g_decryptThreads(0);
+
+widevine::Cdm::IStorage* g_storage = nullptr;
+
+// One cipher context per thread, so decrypting does not allocate.
+class Cipher {
+public:
+    Cipher(const Cipher&) = delete;
+    Cipher& operator=(const Cipher&) = delete;
+
+    Cipher()
+        : _context(EVP_CIPHER_CTX_new())
+    {
+    }
+    ~Cipher()
+    {
+        EVP_CIPHER_CTX_free(_context);
+    }
+
+public:
+    // Whole blocks only, in place allowed.
+    void Ecb(const uint8_t key[], const uint8_t* input, uint8_t* output, const uint32_t length)
+    {
+        Run(EVP_aes_128_ecb(), true, key, nullptr, input, output, length);
+    }
+    // Whole blocks only, in place. The chain is the IV on entry and the
+    // IV of the next run on return.
+    void Cbc(const bool encrypt, const uint8_t key[], uint8_t chain[], uint8_t* data, const uint32_t length)
+    {
+        uint8_t next[16];
+
+        if (encrypt == false) {
+            ::memcpy(next, &(data[length - 16]), 16);
+        }
+
+        Run(EVP_aes_128_cbc(), encrypt, key, chain, data, data, length);
+
+        ::memcpy(chain, (encrypt == true ? &(data[length - 16]) : next), 16);
+    }
+
+private:
+    void Run(const EVP_CIPHER* type, const bool encrypt, const uint8_t key[], const uint8_t iv[], const uint8_t* input, uint8_t* output, const uint32_t length)
+    {
+        int written = 0;
+        EVP_CipherInit_ex(_context, type, nullptr, key, iv, (encrypt == true ? 1 : 0));
+        EVP_CIPHER_CTX_set_padding(_context, 0);
+        EVP_CipherUpdate(_context, output, &written, input, static_cast<int>(length));
+    }
+
+private:
+    EVP_CIPHER_CTX* _context;
+};
+
+thread_local Cipher t_cipher;
+thread_local bool t_decrypting = false;
+
+// CENC counts in the lower 64 bits of the counter block.
+void Increment(uint8_t counter[])
+{
+    for (int index = 15; index >= 8; index--) {
+        if (++counter[index] != 0) {
+            break;
+        }
+    }
+}
+
+void Ctr(const uint8_t key[], uint8_t counter[], uint8_t* data, const uint32_t length)
+{
+    static constexpr uint32_t Batch = 64;
+    uint8_t stream[Batch * 16];
+    uint32_t offset = 0;
+
+    while (offset < length) {
+        const uint32_t size = std::min<uint32_t>(length - offset, Batch * 16);
+        const uint32_t blocks = (size + 15) / 16;
+
+        for (uint32_t index = 0; index < blocks; index++) {
+            ::memcpy(&(stream[index * 16]), counter, 16);
+            Increment(counter);
+        }
+        t_cipher.Ecb(key, stream, stream, blocks * 16);
+
+        for (uint32_t index = 0; index < size; index++) {
+            data[offset + index] ^= stream[index];
+        }
+        offset += size;
+    }
+}
+
+// Encrypting and decrypting only differ for CBC. Patterned, the protected
+// runs advance the counter or continue the chain, the clear ones are
+// skipped. Trailing partial blocks stay clear, except for unpatterned CTR.
+void Apply(
+    const bool encrypt,
+    const widevine::Cdm::EncryptionScheme scheme,
+    const widevine::Cdm::Pattern& pattern,
+    const uint8_t key[],
+    const uint8_t iv[],
+    uint8_t* data,
+    const uint32_t length)
+{
+    uint8_t state[16];
+    ::memcpy(state, iv, 16);
+
+    const uint32_t blocks = length / 16;
+    const uint32_t encrypted = (pattern.encrypted_blocks != 0 ? pattern.encrypted_blocks : blocks);
+    const uint32_t clear = (pattern.encrypted_blocks != 0 ? pattern.clear_blocks : 0);
+
+    if ((scheme == widevine::Cdm::kAesCtr) && (pattern.encrypted_blocks == 0)) {
+        Ctr(key, state, data, length);
+        return;
+    }
+
+    for (uint32_t block = 0; block < blocks; block += encrypted + clear) {
+        const uint32_t run = std::min(encrypted, blocks - block) * 16;
+
+        if (run == 0) {
+            break;
+        } else if (scheme == widevine::Cdm::kAesCtr) {
+            Ctr(key, state, &(data[block * 16]), run);
+        } else {
+            t_cipher.Cbc(encrypt, key, state, &(data[block * 16]), run);
+        }
+    }
+}
+
+bool Parse(const std::string& license, Keys& keys)
+{
+    const uint32_t record = 2 * Stub::KeySize;
+
+    if ((license.empty() == true) || ((license.size() % record) != 0)) {
+        return (false);
+    }
+
+    keys.resize(license.size() / record);
+    for (uint32_t index = 0; index < keys.size(); index++) {
+        ::memcpy(keys[index].id, &(license[index * record]), Stub::KeySize);
+        ::memcpy(keys[index].value, &(license[(index * record) + Stub::KeySize]), Stub::KeySize);
+        keys[index].expired = false;
+    }
+    return (true);
+}
+
+std::string LicenseName(const std::string& sessionId)
+{
+    return (sessionId + ".lic");
+}
+
+class StubCdm;
+std::atomic<StubCdm*> g_cdm(nullptr);
+
+class StubCdm : public widevine::Cdm {
+public:
+    StubCdm(const StubCdm&) = delete;
+    StubCdm& operator=(const StubCdm&) = delete;
+
+    StubCdm(IEventListener* listener, IStorage* storage)
+        : _listener(listener)
+        , _storage(storage)
+        , _lock(PTHREAD_RWLOCK_INITIALIZER)
+        , _sessions()
+        , _next(0)
+    {
+        g_cdm.store(this);
+    }
+    ~StubCdm() override
+    {
+        g_cdm.store(nullptr);
+        ::pthread_rwlock_destroy(&_lock);
+    }
+
+public:
+    void Renew(const std::string& sessionId, const std::string& message)
+    {
+        _listener->onMessage(sessionId, kLicenseRenewal, message);
+    }
+    void Expire(const std::string& sessionId, const uint8_t keyId[])
+    {
+        bool found = false;
+
+        ::pthread_rwlock_wrlock(&_lock);
+        std::map<std::string, Session>::iterator index(_sessions.find(sessionId));
+        if (index != _sessions.end()) {
+            for (Key& key : index->second.keys) {
+                if (::memcmp(key.id, keyId, sizeof(key.id)) == 0) {
+                    key.expired = true;
+                    found = true;
+                }
+            }
+        }
+        ::pthread_rwlock_unlock(&_lock);
+
+        if (found == true) {
+            _listener->onKeyStatusesChange(sessionId, false);
+        }
+    }
+
+    Status setServiceCertificate(ServiceRole, const std::string& certificate) override
+    {
+        return (certificate.empty() == true ? kTypeError : kSuccess);
+    }
+    bool isProvisioned() override
+    {
+        return (true);
+    }
+    Status createSession(SessionType type, std::string* sessionId) override
+    {
+        const uint32_t delay = g_createSessionDelay.load();
+        if (delay != 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        }
+
+        char id[16];
+        ::pthread_rwlock_wrlock(&_lock);
+        ::snprintf(id, sizeof(id), "stub%08u", ++_next);
+        *sessionId = id;
+        Session& session(_sessions[*sessionId]);
+        session.type = type;
+        session.released = false;
+        ::pthread_rwlock_unlock(&_lock);
+
+        g_createdSessions++;
+        g_openSessions++;
+        return (kSuccess);
+    }
+    Status generateRequest(const std::string& sessionId, InitDataType, const std::string& initData) override
+    {
+        if (Exists(sessionId) == false) {
+            return (kSessionNotFound);
+        }
+        _listener->onMessage(sessionId, kLicenseRequest, "request:" + initData);
+        return (kSuccess);
+    }
+    Status load(const std::string& sessionId) override
+    {
+        std::string license;
+        Keys keys;
+
+        if ((_storage == nullptr) || (_storage->read(LicenseName(sessionId), &license) == false) || (Parse(license, keys) == false)) {
+            return (kSessionNotFound);
+        }
+
+        ::pthread_rwlock_wrlock(&_lock);
+        Session& session(_sessions[sessionId]);
+        session.type = kPersistentLicense;
+        session.keys = keys;
+        session.released = false;
+        ::pthread_rwlock_unlock(&_lock);
+
+        _listener->onKeyStatusesChange(sessionId, true);
+        return (kSuccess);
+    }
+    Status update(const std::string& sessionId, const std::string& response) override
+    {
+        Keys keys;
+        if (Parse(response, keys) == false) {
+            return (kTypeError);
+        }
+
+        bool added = false;
+        std::string license;
+
+        ::pthread_rwlock_wrlock(&_lock);
+        std::map<std::string, Session>::iterator index(_sessions.find(sessionId));
+        if (index == _sessions.end()) {
+            ::pthread_rwlock_unlock(&_lock);
+            return (kSessionNotFound);
+        }
+        Session& session(index->second);
+        for (const Key& key : keys) {
+            Keys::iterator entry(session.keys.begin());
+            while ((entry != session.keys.end()) && (::memcmp(entry->id, key.id, sizeof(key.id)) != 0)) {
+                entry++;
+            }
+            if (entry == session.keys.end()) {
+                session.keys.push_back(key);
+                added = true;
+            } else {
+                ::memcpy(entry->value, key.value, sizeof(key.value));
+                entry->expired = false;
+            }
+        }
+        session.released = false;
+        if (session.type == kPersistentLicense) {
+            for (const Key& key : session.keys) {
+                license.append(reinterpret_cast<const char*>(key.id), sizeof(key.id));
+                license.append(reinterpret_cast<const char*>(key.value), sizeof(key.value));
+            }
+        }
+        ::pthread_rwlock_unlock(&_lock);
+
+        if ((license.empty() == false) && (_storage != nullptr)) {
+            _storage->write(LicenseName(sessionId), license);
+        }
+
+        _listener->onKeyStatusesChange(sessionId, added);
+        return (kSuccess);
+    }
+    Status getKeyStatuses(const std::string& sessionId, KeyStatusMap* statuses) override
+    {
+        Status result = kSessionNotFound;
+
+        statuses->clear();
+
+        ::pthread_rwlock_rdlock(&_lock);
+        std::map<std::string, Session>::const_iterator index(_sessions.find(sessionId));
+        if (index != _sessions.end()) {
+            for (const Key& key : index->second.keys) {
+                (*statuses)[std::string(reinterpret_cast<const char*>(key.id), sizeof(key.id))] = (index->second.released == true ? kReleased : (key.expired == true ? kExpired : kUsable));
+            }
+            result = kSuccess;
+        }
+        ::pthread_rwlock_unlock(&_lock);
+
+        return (result);
+    }
+    Status close(const std::string& sessionId) override
+    {
+        ::pthread_rwlock_wrlock(&_lock);
+        const bool erased = (_sessions.erase(sessionId) == 1);
+        ::pthread_rwlock_unlock(&_lock);
+
+        if (erased == true) {
+            g_openSessions--;
+        }
+        return (erased == true ? kSuccess : kSessionNotFound);
+    }
+    Status remove(const std::string& sessionId) override
+    {
+        ::pthread_rwlock_wrlock(&_lock);
+        std::map<std::string, Session>::iterator index(_sessions.find(sessionId));
+        const bool found = (index != _sessions.end());
+        if (found == true) {
+            index->second.released = true;
+        }
+        ::pthread_rwlock_unlock(&_lock);
+
+        if (found == false) {
+            return (kSessionNotFound);
+        }
+        if (_storage != nullptr) {
+            _storage->remove(LicenseName(sessionId));
+        }
+        _listener->onKeyStatusesChange(sessionId, false);
+        _listener->onRemoveComplete(sessionId);
+        return (kSuccess);
+    }
+    Status decrypt(const InputBuffer& input, const OutputBuffer& output) override
+    {
+        uint8_t* data = static_cast<uint8_t*>(output.data) + output.data_offset;
+
+        if (output.data_length < input.data_length) {
+            return (kDecryptError);
+        }
+        if (data != input.data) {
+            ::memmove(data, input.data, input.data_length);
+        }
+        if (input.encryption_scheme == kClear) {
+            return (kSuccess);
+        }
+
+        uint8_t key[Stub::KeySize];
+        uint8_t iv[16];
+
+        if ((input.key_id_length != Stub::KeySize) || (Find(input.key_id, key) == false)) {
+            return (kNoKey);
+        }
+
+        ::memset(iv, 0, sizeof(iv));
+        ::memcpy(iv, input.iv, std::min<uint32_t>(input.iv_length, sizeof(iv)));
+
+        Apply(false, input.encryption_scheme, input.pattern, key, iv, data, input.data_length);
+
+        g_decryptCalls++;
+        if (t_decrypting == false) {
+            t_decrypting = true;
+            g_decryptThreads++;
+        }
+        return (kSuccess);
+    }
+
+private:
+    bool Exists(const std::string& sessionId)
+    {
+        ::pthread_rwlock_rdlock(&_lock);
+        const bool result = (_sessions.find(sessionId) != _sessions.end());
+        ::pthread_rwlock_unlock(&_lock);
+        return (result);
+    }
+    // Like the real CDM, decrypt finds the key in any open session.
+    bool Find(const uint8_t keyId[], uint8_t key[])
+    {
+        bool result = false;
+
+        ::pthread_rwlock_rdlock(&_lock);
+        for (std::map<std::string, Session>::const_iterator index = _sessions.begin(); (index != _sessions.end()) && (result == false); index++) {
+            if (index->second.released == false) {
+                for (const Key& entry : index->second.keys) {
+                    if ((entry.expired == false) && (::memcmp(entry.id, keyId, sizeof(entry.id)) == 0)) {
+                        ::memcpy(key, entry.value, sizeof(entry.value));
+                        result = true;
+                        break;
+                    }
+                }
+            }
+        }
+        ::pthread_rwlock_unlock(&_lock);
+
+        return (result);
+    }
+
+private:
+    IEventListener* _listener;
+    IStorage* _storage;
+    pthread_rwlock_t _lock;
+    std::map<std::string, Session> _sessions;
+    uint32_t _next;
+};
+
+} // namespace
+
+namespace widevine {
+
+/* static */ Cdm::Status Cdm::initialize(SecureOutputType, const ClientInfo&, IStorage* storage, IClock*, ITimer*, LogLevel)
+{
+    const uint32_t delay = g_initializeDelay.load();
+    if (delay != 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    }
+    g_storage = storage;
+    return (kSuccess);
+}
+
+/* static */ Cdm* Cdm::create(IEventListener* listener, IStorage* storage, bool)
+{
+    return (new StubCdm(listener, (storage != nullptr ? storage : g_storage)));
+}
+
+} // namespace widevine
+
+namespace wvcdm {
+
+std::string a2bs_hex(const std::string& hex)
+{
+    std::string result;
+    result.reserve(hex.size() / 2);
+    for (size_t index = 0; (index + 1) < hex.size(); index += 2) {
+        result += static_cast<char>(::strtoul(hex.substr(index, 2).c_str(), nullptr, 16));
+    }
+    return (result);
+}
+
+} // namespace wvcdm
+
+namespace Stub {
+
+void InitializeDelay(const uint32_t milliseconds)
+{
+    g_initializeDelay.store(milliseconds);
+}
+
+void CreateSessionDelay(const uint32_t milliseconds)
+{
+    g_createSessionDelay.store(milliseconds);
+}
+
+uint32_t CreatedSessions()
+{
+    return (g_createdSessions.load());
+}
+
+uint32_t OpenSessions()
+{
+    return (g_openSessions.load());
+}
+
+uint64_t DecryptCalls()
+{
+    return (g_decryptCalls.load());
+}
+
+uint32_t DecryptThreads()
+{
+    return (g_decryptThreads.load());
+}
+
+std::string License(const uint8_t keyId[KeySize], const uint8_t key[KeySize])
+{
+    std::string result(reinterpret_cast<const char*>(keyId), KeySize);
+    result.append(reinterpret_cast<const char*>(key), KeySize);
+    return (result);
+}
+
+void Renew(const std::string& sessionId, const std::string& message)
+{
+    StubCdm* cdm = g_cdm.load();
+    if (cdm != nullptr) {
+        cdm->Renew(sessionId, message);
+    }
+}
+
+void Expire(const std::string& sessionId, const uint8_t keyId[KeySize])
+{
+    StubCdm* cdm = g_cdm.load();
+    if (cdm != nullptr) {
+        cdm->Expire(sessionId, keyId);
+    }
+}
+
+void Encrypt(
+    const widevine::Cdm::EncryptionScheme scheme,
+    const widevine::Cdm::Pattern& pattern,
+    const uint8_t key[KeySize],
+    const uint8_t iv[16],
+    uint8_t* data,
+    const uint32_t length)
+{
+    Apply(true, scheme, pattern, key, iv, data, length);
+}
+
+} // namespace Stub
@@ -0,0 +1,65 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// Controls and counters of the stub widevine::Cdm, for the tests and the
+// benchmark. A license (the response to Update) is a sequence of key id
+// and key pairs, 16 bytes each.
+
+#include "cdm.h"
+
+namespace Stub {
+
+static constexpr uint8_t KeySize = 16;
+
+// Slows down Cdm::initialize and Cdm::createSession, to make the cost
+// the plugin hides from the caller visible.
+void InitializeDelay(const uint32_t milliseconds);
+void CreateSessionDelay(const uint32_t milliseconds);
+
+// Sessions created by Cdm::createSession, in total and still open.
+uint32_t CreatedSessions();
+uint32_t OpenSessions();
+
+// Calls to Cdm::decrypt that succeeded, and the number of distinct
+// threads that made them.
+uint64_t DecryptCalls();
+uint32_t DecryptThreads();
+
+std::string License(const uint8_t keyId[KeySize], const uint8_t key[KeySize]);
+
+// Has the CDM send a license renewal request for the session, from the
+// calling thread.
+void Renew(const std::string& sessionId, const std::string& message = "renewal");
+
+// Expires one key of the session and reports the change, from the calling
+// thread. A license for the key makes it usable again.
+void Expire(const std::string& sessionId, const uint8_t keyId[KeySize]);
+
+// The reverse of Cdm::decrypt, for building the test content.
+void Encrypt(
+    const widevine::Cdm::EncryptionScheme scheme,
+    const widevine::Cdm::Pattern& pattern,
+    const uint8_t key[KeySize],
+    const uint8_t iv[16],
+    uint8_t* data,
+    const uint32_t length);
+
+} // namespace Stub
@@ -0,0 +1,162 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2020 Metrological
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// Stand-in for the OCDM cdmi.h, limited to the interfaces the plugin
+// implements and the system factory the tests get it from.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifndef VARIABLE_IS_NOT_USED
+#define VARIABLE_IS_NOT_USED __attribute__((unused))
+#endif
+
+namespace Thunder {
+namespace PluginHost {
+    struct IShell;
+}
+}
+
+namespace CDMi {
+
+enum CDMi_RESULT {
+    CDMi_SUCCESS = 0,
+    CDMi_S_FALSE = 1
+};
+
+enum LicenseType {
+    Temporary = 0,
+    PersistentUsageRecord,
+    PersistentLicense
+};
+
+enum EncryptionScheme {
+    Clear = 0,
+    AesCtr_Cenc,
+    AesCtr_Cens,
+    AesCbc_Cbc1,
+    AesCbc_Cbcs
+};
+
+struct EncryptionPattern {
+    uint32_t encrypted_blocks;
+    uint32_t clear_blocks;
+};
+
+struct IMediaKeySessionCallback {
+    virtual ~IMediaKeySessionCallback() {}
+
+    virtual void OnKeyMessage(const uint8_t* f_pbKeyMessage, uint32_t f_cbKeyMessage, const char* f_pszUrl) = 0;
+    virtual void OnError(int16_t f_nError, CDMi_RESULT f_crSysError, const char* errorMessage) = 0;
+    virtual void OnKeyStatusUpdate(const char* keyMessage, const uint8_t* buffer, const uint8_t length) = 0;
+    virtual void OnKeyStatusesUpdated() const = 0;
+};
+
+struct IMediaKeySession {
+    virtual ~IMediaKeySession() {}
+
+    virtual const char* GetKeySystem() const = 0;
+    virtual const char* GetSessionId() const = 0;
+    virtual void Run(const IMediaKeySessionCallback* f_piMediaKeySessionCallback) = 0;
+    virtual CDMi_RESULT Load() = 0;
+    virtual void Update(const uint8_t* f_pbKeyMessageResponse, uint32_t f_cbKeyMessageResponse) = 0;
+    virtual CDMi_RESULT Remove() = 0;
+    virtual CDMi_RESULT Close() = 0;
+    virtual CDMi_RESULT Decrypt(
+        const uint8_t* f_pbSessionKey,
+        uint32_t f_cbSessionKey,
+        const EncryptionScheme encryptionScheme,
+        const EncryptionPattern& pattern,
+        const uint8_t* f_pbIV,
+        uint32_t f_cbIV,
+        uint8_t* f_pbData,
+        uint32_t f_cbData,
+        uint32_t* f_pcbOpaqueClearContent,
+        uint8_t** f_ppbOpaqueClearContent,
+        const uint8_t keyIdLength,
+        const uint8_t* keyId,
+        bool initWithLast15) = 0;
+    virtual CDMi_RESULT ReleaseClearContent(
+        const uint8_t* f_pbSessionKey,
+        uint32_t f_cbSessionKey,
+        const uint32_t f_cbClearContentOpaque,
+        uint8_t* f_pbClearContentOpaque) = 0;
+};
+
+struct IMediaKeys {
+    virtual ~IMediaKeys() {}
+
+    virtual CDMi_RESULT CreateMediaKeySession(
+        const std::string& keySystem,
+        int32_t licenseType,
+        const char* f_pwszInitDataType,
+        const uint8_t* f_pbInitData,
+        uint32_t f_cbInitData,
+        const uint8_t* f_pbCDMData,
+        uint32_t f_cbCDMData,
+        IMediaKeySession** f_ppiMediaKeySession) = 0;
+    virtual CDMi_RESULT SetServerCertificate(const uint8_t* f_pbServerCertificate, uint32_t f_cbServerCertificate) = 0;
+    virtual CDMi_RESULT DestroyMediaKeySession(IMediaKeySession* f_piMediaKeySession) = 0;
+};
+
+struct ISystemFactory {
+    virtual ~ISystemFactory() {}
+
+    virtual IMediaKeys* Instance() = 0;
+    virtual const std::vector<std::string>& MimeTypes() const = 0;
+    virtual void Initialize(const Thunder::PluginHost::IShell* shell, const std::string& configline) = 0;
+};
+
+template <typename IMPLEMENTATION>
+class SystemFactoryType : public ISystemFactory {
+public:
+    SystemFactoryType(const std::vector<std::string>& list)
+        : _mimes(list)
+        , _instance()
+    {
+    }
+
+    IMediaKeys* Instance() override
+    {
+        return (&_instance);
+    }
+    const std::vector<std::string>& MimeTypes() const override
+    {
+        return (_mimes);
+    }
+    void Initialize(const Thunder::PluginHost::IShell* shell, const std::string& configline) override
+    {
+        _instance.Initialize(shell, configline);
+    }
+
+private:
+    std::vector<std::string> _mimes;
+    IMPLEMENTATION _instance;
+};
+
+} // namespace CDMi
+
+extern "C" {
+
+CDMi::ISystemFactory* GetSystemFactory();
+
+}